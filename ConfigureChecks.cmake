@@ -13,12 +13,16 @@ CHECK_INCLUDE_FILE(locale.h HAVE_LOCALE_H)
 CHECK_INCLUDE_FILE(libgen.h HAVE_LIBGEN_H)
 CHECK_INCLUDE_FILE(unistd.h HAVE_UNISTD_H)
 CHECK_INCLUDE_FILE(direct.h HAVE_DIRECT_H)
+CHECK_INCLUDE_FILE(spawn.h HAVE_SPAWN_H)
 CHECK_INCLUDE_FILE(stdint.h HAVE_STDINT_H)
 
 CHECK_SYMBOL_EXISTS(abort "stdlib.h" HAVE_ABORT)
 
 CHECK_FUNCTION_EXISTS(getcwd HAVE_GETCWD)
 CHECK_FUNCTION_EXISTS(toascii HAVE_TOASCII)
+CHECK_FUNCTION_EXISTS(popen HAVE_POPEN)
+CHECK_FUNCTION_EXISTS(posix_spawnp HAVE_POSIX_SPAWNP)
+CHECK_FUNCTION_EXISTS(mkstemp HAVE_MKSTEMP)
 
 CHECK_LIBRARY_EXISTS(dl dlopen "" HAVE_LIBDL)
 
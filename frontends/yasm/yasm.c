@@ -69,7 +69,9 @@ static int special_options = 0;
     cur_listfmt_module = NULL;
 static int preproc_only = 0;
 static unsigned int force_strict = 0;
+static unsigned int jcc_erratum = 0;
 static int generate_make_dependencies = 0;
+static int make_pch = 0;
 static int warning_error = 0;   /* warnings being treated as errors */
 static FILE *errfile;
 /*@null@*/ /*@only@*/ static char *error_filename = NULL;
@@ -98,10 +100,13 @@ static int opt_objfile_handler(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_mapfile_handler(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_machine_handler(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_strict_handler(char *cmd, /*@null@*/ char *param, int extra);
+static int opt_jcc_erratum_handler(char *cmd, /*@null@*/ char *param,
+                                   int extra);
 static int opt_warning_handler(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_error_file(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_error_stdout(char *cmd, /*@null@*/ char *param, int extra);
 static int preproc_only_handler(char *cmd, /*@null@*/ char *param, int extra);
+static int opt_make_pch_handler(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_include_option(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_preproc_option(char *cmd, /*@null@*/ char *param, int extra);
 static int opt_ewmsg_handler(char *cmd, /*@null@*/ char *param, int extra);
@@ -174,6 +179,8 @@ static opt_option options[] =
       N_("select machine (list with -m help)"), N_("machine") },
     { 0, "force-strict", 0, opt_strict_handler, 0,
       N_("treat all sized operands as if `strict' was used"), NULL },
+    { 0, "jcc-erratum", 0, opt_jcc_erratum_handler, 0,
+      N_("pad x86 branches to keep them within 32-byte boundaries"), NULL },
     { 'w', NULL, 0, opt_warning_handler, 1,
       N_("inhibits warning messages"), NULL },
     { 'W', NULL, 0, opt_warning_handler, 0,
@@ -194,6 +201,11 @@ static opt_option options[] =
       N_("add include path"), N_("path") },
     { 'P', NULL, 1, opt_preproc_option, 0,
       N_("pre-include file"), N_("filename") },
+    { 0, "include-pch", 1, opt_preproc_option, 3,
+      N_("pre-include precompiled macros"), N_("filename") },
+    { 0, "make-pch", 0, opt_make_pch_handler, 0,
+      N_("preprocess only and save the macros defined as precompiled macros"),
+      NULL },
     { 'd', NULL, 1, opt_preproc_option, 1,
       N_("pre-define a macro, optionally to value"), N_("macro[=value]") },
     { 'D', NULL, 1, opt_preproc_option, 1,
@@ -262,6 +274,25 @@ do_preproc_only(void)
     linemap = yasm_linemap_create();
     yasm_linemap_set(linemap, in_filename, 0, 1, 1);
 
+    if (make_pch) {
+        if (!cur_preproc_module->write_pch) {
+            print_error(
+                _("%s: preprocessor `%s' does not support precompiled macros"),
+                _("FATAL"), cur_preproc_module->keyword);
+            return EXIT_FAILURE;
+        }
+
+        /* determine the output filename if not specified */
+        if (!obj_filename) {
+            yasm__splitpath(in_filename, &base_filename);
+            if (base_filename[0] == '\0')
+                obj_filename = yasm__xstrdup("yasm.pch");
+            else
+                obj_filename = replace_extension(base_filename, "pch",
+                                                 "yasm.pch");
+        }
+    }
+
     /* Default output to stdout if not specified or generating dependency
        makefiles */
     if (!obj_filename || generate_make_dependencies) {
@@ -285,7 +316,7 @@ do_preproc_only(void)
         }
     } else {
         /* Open output (object) file */
-        out = open_file(obj_filename, "wt");
+        out = open_file(obj_filename, make_pch ? "wb" : "wt");
         if (!out)
             return EXIT_FAILURE;
     }
@@ -321,6 +352,11 @@ do_preproc_only(void)
         }
         fputc('\n', stdout);
         yasm_xfree(preproc_buf);
+    } else if (make_pch) {
+        /* Only the macros defined are wanted, not the output */
+        while ((preproc_buf = yasm_preproc_get_line(cur_preproc)) != NULL)
+            yasm_xfree(preproc_buf);
+        yasm_preproc_write_pch(cur_preproc, out);
     } else {
         while ((preproc_buf = yasm_preproc_get_line(cur_preproc)) != NULL) {
             fputs(preproc_buf, out);
@@ -490,6 +526,7 @@ do_assemble(void)
     }
 
     yasm_arch_set_var(cur_arch, "force_strict", force_strict);
+    yasm_arch_set_var(cur_arch, "jcc_erratum", jcc_erratum);
 
     /* Try to enable the map file via a map NASM directive.  This is
      * somewhat of a hack.
@@ -717,6 +754,20 @@ main(int argc, char *argv[])
         }
     }
 
+    /* Don't silently drop --include-pch on preprocs that can't load it. */
+    if (!cur_preproc_module->add_include_pch) {
+        constcharparam *cp;
+        STAILQ_FOREACH(cp, &preproc_options, link) {
+            if (cp->id == 3) {
+                print_error(
+                    _("%s: preprocessor `%s' does not support precompiled macros"),
+                    _("FATAL"), cur_preproc_module->keyword);
+                cleanup(NULL);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
     /* Determine input filename and open input file. */
     if (!in_filename) {
         print_error(_("No input files specified"));
@@ -1061,6 +1112,15 @@ opt_strict_handler(/*@unused@*/ char *cmd,
     return 0;
 }
 
+static int
+opt_jcc_erratum_handler(/*@unused@*/ char *cmd,
+                        /*@unused@*/ /*@null@*/ char *param,
+                        /*@unused@*/ int extra)
+{
+    jcc_erratum = 1;
+    return 0;
+}
+
 static int
 opt_warning_handler(char *cmd, /*@unused@*/ char *param, int extra)
 {
@@ -1182,6 +1242,17 @@ opt_makedep_handler(/*@unused@*/ char *cmd, /*@unused@*/ char *param,
     return 0;
 }
 
+static int
+opt_make_pch_handler(/*@unused@*/ char *cmd, /*@unused@*/ char *param,
+                     /*@unused@*/ int extra)
+{
+    /* Also set preproc_only to 1, we don't want to generate code */
+    preproc_only = 1;
+    make_pch = 1;
+
+    return 0;
+}
+
 static int
 opt_prefix_handler(/*@unused@*/ char *cmd, char *param, /*@unused@*/ int extra)
 {
@@ -1255,13 +1326,14 @@ apply_preproc_saved_options()
 {
     constcharparam *cp, *cpnext;
 
-    void (*funcs[3])(yasm_preproc *, const char *);
+    void (*funcs[4])(yasm_preproc *, const char *);
     funcs[0] = cur_preproc_module->add_include_file;
     funcs[1] = cur_preproc_module->predefine_macro;
     funcs[2] = cur_preproc_module->undefine_macro;
+    funcs[3] = cur_preproc_module->add_include_pch;
 
     STAILQ_FOREACH(cp, &preproc_options, link) {
-        if (0 <= cp->id && cp->id < 3 && funcs[cp->id])
+        if (0 <= cp->id && cp->id < 4 && funcs[cp->id])
             funcs[cp->id](cur_preproc, cp->param);
     }
 
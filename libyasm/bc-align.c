@@ -70,7 +70,8 @@ static const yasm_bytecode_callback bc_align_callback = {
     bc_align_calc_len,
     bc_align_expand,
     bc_align_tobytes,
-    YASM_BC_SPECIAL_OFFSET
+    YASM_BC_SPECIAL_OFFSET,
+    NULL
 };
 
 
@@ -229,6 +230,17 @@ bc_align_tobytes(yasm_bytecode *bc, unsigned char **bufp,
     return 0;
 }
 
+int
+yasm_bc_is_code_align(const yasm_bytecode *bc)
+{
+    const bytecode_align *align;
+
+    if (bc->callback != &bc_align_callback)
+        return 0;
+    align = (const bytecode_align *)bc->contents;
+    return !align->fill && align->code_fill;
+}
+
 yasm_bytecode *
 yasm_bc_create_align(yasm_expr *boundary, yasm_expr *fill,
                      yasm_expr *maxskip, const unsigned char **code_fill,
@@ -49,6 +49,7 @@ struct yasm_dataval {
         struct {
             /*@only@*/ unsigned char *contents;
             unsigned long len;
+            unsigned long alloclen;     /* allocated size of contents */
         } raw;
     } data;
 
@@ -82,7 +83,8 @@ static const yasm_bytecode_callback bc_data_callback = {
     bc_data_calc_len,
     yasm_bc_expand_common,
     bc_data_tobytes,
-    0
+    0,
+    NULL
 };
 
 
@@ -227,14 +229,21 @@ bc_data_tobytes(yasm_bytecode *bc, unsigned char **bufp,
                                      (unsigned long)(*bufp-bufstart), bc, 1,
                                      d))
                         return 1;
+                    if (i == 0 && !dv->data.val.rel && !dv->data.val.wrt
+                        && !dv->data.val.seg_of
+                        && !dv->data.val.section_rel) {
+                        /* Absolute value: the rest are copies. */
+                        yasm_bc__replicate(*bufp, val_len, multiple);
+                        *bufp += val_len*multiple;
+                        break;
+                    }
                     *bufp += val_len;
                 }
                 break;
             case DV_RAW:
-                for (i=0; i<multiple; i++) {
-                    memcpy(*bufp, dv->data.raw.contents, dv->data.raw.len);
-                    *bufp += dv->data.raw.len;
-                }
+                memcpy(*bufp, dv->data.raw.contents, dv->data.raw.len);
+                yasm_bc__replicate(*bufp, dv->data.raw.len, multiple);
+                *bufp += dv->data.raw.len*multiple;
                 break;
             case DV_ULEB128:
             case DV_SLEB128:
@@ -248,10 +257,8 @@ bc_data_tobytes(yasm_bytecode *bc, unsigned char **bufp,
                 }
             case DV_RESERVE:
                 val_len = dv->data.val.size/8;
-                for (i=0; i<multiple; i++) {
-                    memset(*bufp, 0, val_len);
-                    *bufp += val_len;
-                }
+                memset(*bufp, 0, val_len*multiple);
+                *bufp += val_len*multiple;
                 break;
         }
     }
@@ -464,6 +471,7 @@ yasm_dv_create_raw(unsigned char *contents, unsigned long len)
     retval->type = DV_RAW;
     retval->data.raw.contents = contents;
     retval->data.raw.len = len;
+    retval->data.raw.alloclen = len;
     retval->multiple = NULL;
 
     return retval;
@@ -556,6 +564,44 @@ yasm_dvs_append(yasm_datavalhead *headp, yasm_dataval *dv)
     return (yasm_dataval *)NULL;
 }
 
+void
+yasm_dvs_append_expr(yasm_datavalhead *headp, yasm_expr *expn,
+                     unsigned int size, yasm_arch *arch)
+{
+    yasm_dataval *dv = STAILQ_LAST(headp, yasm_dataval, link);
+    /*@dependent@*/ /*@null@*/ const yasm_intnum *intn;
+    unsigned char *buf;
+
+    intn = yasm_expr_get_intnum(&expn, 0);
+    if (!intn || size == 0 || (!arch && size != 1)) {
+        yasm_dvs_append(headp, yasm_dv_create_expr(expn));
+        return;
+    }
+
+    /* Extend the trailing raw value if its contents need no padding;
+     * otherwise start a new one.
+     */
+    if (!dv || dv->type != DV_RAW || dv->multiple
+        || dv->data.raw.len % size != 0) {
+        dv = yasm_dv_create_raw(yasm_xmalloc(16*size), 0);
+        dv->data.raw.alloclen = 16*size;
+        yasm_dvs_append(headp, dv);
+    } else if (dv->data.raw.len + size > dv->data.raw.alloclen) {
+        dv->data.raw.alloclen = 2*dv->data.raw.alloclen + size;
+        dv->data.raw.contents = yasm_xrealloc(dv->data.raw.contents,
+                                              dv->data.raw.alloclen);
+    }
+
+    /* Convert exactly as yasm_bc_create_data() would. */
+    buf = &dv->data.raw.contents[dv->data.raw.len];
+    if (size == 1)
+        yasm_intnum_get_sized(intn, buf, 1, 8, 0, 0, 1);
+    else
+        yasm_arch_intnum_tobytes(arch, intn, buf, size, size*8, 0, NULL, 1);
+    dv->data.raw.len += size;
+    yasm_expr_destroy(expn);
+}
+
 void
 yasm_dvs_print(const yasm_datavalhead *head, FILE *f, int indent_level)
 {
@@ -50,6 +50,11 @@ typedef struct bytecode_incbin {
 
     /* maximum number of bytes to read (NULL=no limit) */
     /*@only@*/ /*@null@*/ yasm_expr *maxlen;
+
+    /* pathname the file was found at by the include path search; NULL
+     * until the file has been located by calc_len
+     */
+    /*@only@*/ /*@null@*/ char *path;
 } bytecode_incbin;
 
 static void bc_incbin_destroy(void *contents);
@@ -70,7 +75,8 @@ static const yasm_bytecode_callback bc_incbin_callback = {
     bc_incbin_calc_len,
     yasm_bc_expand_common,
     bc_incbin_tobytes,
-    0
+    0,
+    NULL
 };
 
 
@@ -79,6 +85,8 @@ bc_incbin_destroy(void *contents)
 {
     bytecode_incbin *incbin = (bytecode_incbin *)contents;
     yasm_xfree(incbin->filename);
+    if (incbin->path)
+        yasm_xfree(incbin->path);
     yasm_expr_destroy(incbin->start);
     yasm_expr_destroy(incbin->maxlen);
     yasm_xfree(contents);
@@ -162,8 +170,13 @@ bc_incbin_calc_len(yasm_bytecode *bc, yasm_bc_add_span_func add_span,
         }
     }
 
-    /* Open file and determine its length */
-    f = yasm_fopen_include(incbin->filename, incbin->from, "rb", NULL);
+    /* Open file (remembering where it was found) and determine its length */
+    if (incbin->path) {
+        yasm_xfree(incbin->path);
+        incbin->path = NULL;
+    }
+    f = yasm_fopen_include(incbin->filename, incbin->from, "rb",
+                           &incbin->path);
     if (!f) {
         yasm_error_set(YASM_ERROR_IO,
                        N_("`incbin': unable to open file `%s'"),
@@ -174,6 +187,7 @@ bc_incbin_calc_len(yasm_bytecode *bc, yasm_bc_add_span_func add_span,
         yasm_error_set(YASM_ERROR_IO,
                        N_("`incbin': unable to seek on file `%s'"),
                        incbin->filename);
+        fclose(f);
         return -1;
     }
     flen = (unsigned long)ftell(f);
@@ -214,8 +228,10 @@ bc_incbin_tobytes(yasm_bytecode *bc, unsigned char **bufp,
         start = yasm_intnum_get_uint(num);
     }
 
-    /* Open file */
-    f = yasm_fopen_include(incbin->filename, incbin->from, "rb", NULL);
+    /* Open file where calc_len found it */
+    if (!incbin->path)
+        yasm_internal_error(N_("incbin file not located in bc_tobytes_incbin"));
+    f = fopen(incbin->path, "rb");
     if (!f) {
         yasm_error_set(YASM_ERROR_IO, N_("`incbin': unable to open file `%s'"),
                        incbin->filename);
@@ -260,6 +276,7 @@ yasm_bc_create_incbin(char *filename, yasm_expr *start, yasm_expr *maxlen,
     incbin->start = start;
     incbin->maxlen = maxlen;
     /*@=mustfree@*/
+    incbin->path = NULL;
 
     return yasm_bc_create_common(&bc_incbin_callback, incbin, line);
 }
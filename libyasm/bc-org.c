@@ -64,7 +64,8 @@ static const yasm_bytecode_callback bc_org_callback = {
     bc_org_calc_len,
     bc_org_expand,
     bc_org_tobytes,
-    YASM_BC_SPECIAL_OFFSET
+    YASM_BC_SPECIAL_OFFSET,
+    NULL
 };
 
 
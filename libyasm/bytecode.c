@@ -297,6 +297,59 @@ yasm_bc_expand(yasm_bytecode *bc, int span, long old_val, long new_val,
                                     pos_thres);
 }
 
+unsigned long
+yasm_bc_pad(yasm_bytecode *bc, unsigned long len)
+{
+    if (!bc->callback || !bc->callback->pad)
+        return 0;
+    return bc->callback->pad(bc, len);
+}
+
+/* Output functions wrapper used while converting the first repetition of a
+ * multiple bytecode, to note whether anything in it depends on its position.
+ */
+typedef struct bc_tobytes_info {
+    yasm_output_value_func output_value;
+    /*@null@*/ yasm_output_reloc_func output_reloc;
+    void *d;
+    int position_dependent;
+} bc_tobytes_info;
+
+static int
+bc_tobytes_output_value(yasm_value *value, unsigned char *buf,
+                        unsigned int destsize, unsigned long offset,
+                        yasm_bytecode *bc, int warn, void *d)
+{
+    bc_tobytes_info *info = (bc_tobytes_info *)d;
+    if (value->rel || value->wrt || value->seg_of || value->section_rel)
+        info->position_dependent = 1;
+    return info->output_value(value, buf, destsize, offset, bc, warn,
+                              info->d);
+}
+
+static int
+bc_tobytes_output_reloc(yasm_symrec *sym, yasm_bytecode *bc,
+                        unsigned char *buf, unsigned int destsize,
+                        unsigned int valsize, int warn, void *d)
+{
+    bc_tobytes_info *info = (bc_tobytes_info *)d;
+    info->position_dependent = 1;
+    return info->output_reloc(sym, bc, buf, destsize, valsize, warn, info->d);
+}
+
+void
+yasm_bc__replicate(unsigned char *buf, unsigned long len,
+                   unsigned long count)
+{
+    unsigned long done = len, total = len*count;
+
+    while (done < total) {
+        unsigned long n = done < total-done ? done : total-done;
+        memcpy(buf+done, buf, n);
+        done += n;
+    }
+}
+
 /*@null@*/ /*@only@*/ unsigned char *
 yasm_bc_tobytes(yasm_bytecode *bc, unsigned char *buf, unsigned long *bufsize,
                 /*@out@*/ int *gap, void *d,
@@ -309,6 +362,7 @@ yasm_bc_tobytes(yasm_bytecode *bc, unsigned char *buf, unsigned long *bufsize,
     unsigned char *origbuf, *destbuf;
     long i;
     int error = 0;
+    bc_tobytes_info info;
 
     long mult;
     if (yasm_bc_get_multiple(bc, &mult, 1) || mult == 0) {
@@ -338,12 +392,32 @@ yasm_bc_tobytes(yasm_bytecode *bc, unsigned char *buf, unsigned long *bufsize,
         yasm_internal_error(N_("got empty bytecode in bc_tobytes"));
     else for (i=0; i<bc->mult_int; i++) {
         origbuf = destbuf;
-        error = bc->callback->tobytes(bc, &destbuf, bufstart, d, output_value,
-                                      output_reloc);
+        if (i == 0 && bc->mult_int > 1) {
+            /* Watch the first repetition; if it has no relocations or
+             * relative values, all the others are identical copies of it.
+             */
+            info.output_value = output_value;
+            info.output_reloc = output_reloc;
+            info.d = d;
+            info.position_dependent = 0;
+            error = bc->callback->tobytes(bc, &destbuf, bufstart, &info,
+                                          bc_tobytes_output_value,
+                                          output_reloc ?
+                                          bc_tobytes_output_reloc : NULL);
+        } else
+            error = bc->callback->tobytes(bc, &destbuf, bufstart, d,
+                                          output_value, output_reloc);
 
         if (!error && ((unsigned long)(destbuf - origbuf) != bc->len))
             yasm_internal_error(
                 N_("written length does not match optimized length"));
+
+        if (i == 0 && bc->mult_int > 1 && !error
+            && !info.position_dependent) {
+            yasm_bc__replicate(bufstart, bc->len,
+                               (unsigned long)bc->mult_int);
+            break;
+        }
     }
 
     return mybuf;
@@ -177,6 +177,16 @@ typedef struct yasm_bytecode_callback {
         /** Instruction bytecode. */
         YASM_BC_SPECIAL_INSN
     } special;
+
+    /** Lengthens the bytecode without changing its effect (e.g. by using
+     * a longer encoding), so it can take up padding that a following code
+     * alignment would otherwise fill with NOPs.  Called from yasm_bc_pad()
+     * after optimization.  May be NULL if the bytecode can't be lengthened.
+     * \param bc            bytecode
+     * \param len           maximum number of bytes to add
+     * \return Number of bytes bc->len was increased by (at most len).
+     */
+    unsigned long (*pad) (yasm_bytecode *bc, unsigned long len);
 } yasm_bytecode_callback;
 
 /** A bytecode. */
@@ -376,6 +386,14 @@ YASM_LIB_DECL
      /*@keep@*/ /*@null@*/ yasm_expr *maxskip,
      /*@null@*/ const unsigned char **code_fill, unsigned long line);
 
+/** Determine if a bytecode is an alignment filled with code (rather than
+ * with an explicit fill value or 0).
+ * \param bc            bytecode
+ * \return Nonzero if bc is a code-filled alignment.
+ */
+YASM_LIB_DECL
+int yasm_bc_is_code_align(const yasm_bytecode *bc);
+
 /** Create a bytecode that puts the following bytecode at a fixed section
  * offset.
  * \param start         section offset of following bytecode
@@ -404,6 +422,16 @@ YASM_LIB_DECL
 YASM_LIB_DECL
 void yasm_bc__add_symrec(yasm_bytecode *bc, /*@dependent@*/ yasm_symrec *sym);
 
+/** Fill a buffer with copies of its first \a len bytes, doubling the copied
+ * region each time.  For bytecode use only.
+ * \param buf   buffer (at least len*count bytes long)
+ * \param len   length of the data to repeat
+ * \param count total number of copies wanted (including the original)
+ */
+YASM_LIB_DECL
+void yasm_bc__replicate(unsigned char *buf, unsigned long len,
+                        unsigned long count);
+
 /** Delete (free allocated memory for) a bytecode.
  * \param bc    bytecode (only pointer to it); may be NULL
  */
@@ -488,6 +516,16 @@ YASM_LIB_DECL
 int yasm_bc_expand(yasm_bytecode *bc, int span, long old_val, long new_val,
                    /*@out@*/ long *neg_thres, /*@out@*/ long *pos_thres);
 
+/** Lengthen a bytecode by up to len bytes without changing its effect.
+ * \param bc            bytecode
+ * \param len           maximum number of bytes to add
+ * \return Number of bytes the bytecode length was increased by; 0 if the
+ *         bytecode can't be lengthened.
+ * \warning Only valid /after/ optimization; does not update offsets.
+ */
+YASM_LIB_DECL
+unsigned long yasm_bc_pad(yasm_bytecode *bc, unsigned long len);
+
 /** Convert a bytecode into its byte representation.
  * \param bc            bytecode
  * \param buf           byte representation destination buffer
@@ -627,6 +665,22 @@ YASM_LIB_DECL
 /*@null@*/ yasm_dataval *yasm_dvs_append
     (yasm_datavalhead *headp, /*@returned@*/ /*@null@*/ yasm_dataval *dv);
 
+/** Add an expression to the end of a list of data values.  Integer constants
+ * are converted to bytes immediately and packed into a raw data value at the
+ * end of the list, so long runs of constants cost one byte per output byte.
+ * Other expressions are appended as with yasm_dv_create_expr().
+ * \param headp         data value list
+ * \param expn          expression
+ * \param size          size of each data item in bytes (as will be passed to
+ *                      yasm_bc_create_data()); 0 disables packing
+ * \param arch          architecture used to convert constants (may be NULL
+ *                      only if size is 1)
+ */
+YASM_LIB_DECL
+void yasm_dvs_append_expr(yasm_datavalhead *headp,
+                          /*@keep@*/ yasm_expr *expn, unsigned int size,
+                          /*@null@*/ yasm_arch *arch);
+
 /** Print a data value list.  For debugging purposes.
  * \param f             file
  * \param indent_level  indentation level
@@ -115,6 +115,101 @@ yasm_fill_helper(yasm_scanner *s, unsigned char **cursor,
     return first;
 }
 
+void
+yasm_linereader_initialize(yasm_linereader *lr, FILE *f)
+{
+    size_t size = 0, alloc = BSIZE, cnt;
+    long pos, end;
+
+    /* Size the buffer from the remaining file length when it can be found,
+     * so a regular file is read with a single fread().
+     */
+    pos = ftell(f);
+    if (pos >= 0 && fseek(f, 0, SEEK_END) == 0) {
+        end = ftell(f);
+        if (end > pos)
+            alloc = (size_t)(end - pos) + 1;
+        fseek(f, pos, SEEK_SET);
+    }
+
+    lr->buf = yasm_xmalloc(alloc + 1);
+    while ((cnt = fread(&lr->buf[size], 1, alloc - size, f)) > 0) {
+        size += cnt;
+        if (size == alloc) {
+            alloc *= 2;
+            lr->buf = yasm_xrealloc(lr->buf, alloc + 1);
+        }
+    }
+    lr->buf[size] = '\0';
+    lr->cur = lr->buf;
+    lr->lim = &lr->buf[size];
+}
+
+void
+yasm_linereader_initialize_buf(yasm_linereader *lr, const char *buf,
+                               size_t len)
+{
+    lr->buf = yasm_xmalloc(len + 1);
+    memcpy(lr->buf, buf, len);
+    lr->buf[len] = '\0';
+    lr->cur = lr->buf;
+    lr->lim = &lr->buf[len];
+}
+
+void
+yasm_linereader_delete(yasm_linereader *lr)
+{
+    if (lr->buf) {
+        yasm_xfree(lr->buf);
+        lr->buf = NULL;
+    }
+    lr->cur = NULL;
+    lr->lim = NULL;
+}
+
+char *
+yasm_linereader_next(yasm_linereader *lr, int join, size_t *len,
+                     unsigned long *nlines)
+{
+    char *line = lr->cur, *out = lr->cur, *nl;
+    size_t seglen;
+
+    if (!lr->cur || lr->cur >= lr->lim)
+        return NULL;
+
+    *nlines = 0;
+    for (;;) {
+        nl = memchr(lr->cur, '\n', (size_t)(lr->lim - lr->cur));
+        seglen = (size_t)((nl ? nl : lr->lim) - lr->cur);
+        if (out != lr->cur)
+            memmove(out, lr->cur, seglen);
+        out += seglen;
+        lr->cur = nl ? nl+1 : lr->lim;
+        (*nlines)++;
+
+        if (!nl || !join)
+            break;
+
+        /* Continue onto the next line after backslash-LF or
+         * backslash-CRLF.
+         */
+        if (out-line >= 2 && out[-1] == '\r' && out[-2] == '\\')
+            out -= 2;
+        else if (out-line >= 1 && out[-1] == '\\')
+            out--;
+        else
+            break;
+        if (lr->cur >= lr->lim)
+            break;
+    }
+
+    while (out > line && out[-1] == '\r')
+        out--;
+    *out = '\0';
+    *len = (size_t)(out - line);
+    return line;
+}
+
 void
 yasm_unescape_cstring(unsigned char *str, size_t *len)
 {
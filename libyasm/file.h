@@ -72,6 +72,57 @@ int yasm_fill_helper
      size_t (*input_func) (void *d, unsigned char *buf, size_t max),
      void *input_func_data);
 
+/** Whole-file line reader state.  The input is read into memory in one go
+ * and lines are handed out as NUL-terminated slices of that buffer.
+ */
+typedef struct yasm_linereader {
+    char *buf;      /**< File contents, NUL-terminated */
+    char *cur;      /**< Start of next unread line */
+    char *lim;      /**< End of file contents */
+} yasm_linereader;
+
+/** Initialize line reader state by reading the rest of a file.  Read errors
+ * are not reported; check ferror() on the file afterwards if needed.  The
+ * file is not closed.
+ * \param lr        line reader state
+ * \param f         file to read
+ */
+YASM_LIB_DECL
+void yasm_linereader_initialize(yasm_linereader *lr, FILE *f);
+
+/** Initialize line reader state from a copy of a memory buffer.
+ * \param lr        line reader state
+ * \param buf       file contents
+ * \param len       length of buf
+ */
+YASM_LIB_DECL
+void yasm_linereader_initialize_buf(yasm_linereader *lr, const char *buf,
+                                    size_t len);
+
+/** Frees any memory used by line reader state; does not free state itself.
+ * Invalidates all lines returned by yasm_linereader_next().
+ * \param lr        line reader state
+ */
+YASM_LIB_DECL
+void yasm_linereader_delete(yasm_linereader *lr);
+
+/** Get the next line from a line reader.  The line ending and any carriage
+ * returns preceding it are removed.  If join is nonzero, lines ending in a
+ * backslash are joined with the following line (the backslash and line
+ * ending are removed).  The returned line is part of the reader's buffer
+ * and may be modified in place; it remains valid until the reader is
+ * deleted.
+ * \param lr        line reader state
+ * \param join      join backslash-continued lines
+ * \param len       length of returned line (output)
+ * \param nlines    number of physical lines consumed (output)
+ * \return Next line, or NULL at end of file.
+ */
+YASM_LIB_DECL
+/*@null@*/ /*@dependent@*/ char *yasm_linereader_next
+    (yasm_linereader *lr, int join, /*@out@*/ size_t *len,
+     /*@out@*/ unsigned long *nlines);
+
 /** Unescape a string with C-style escapes.  Handles b, f, n, r, t, and hex
  * and octal escapes.  String is updated in-place.
  * Edge cases:
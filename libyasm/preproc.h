@@ -30,6 +30,23 @@
 #ifndef YASM_PREPROC_H
 #define YASM_PREPROC_H
 
+/** Source location of a line returned by yasm_preproc_get_line_ex(). */
+typedef struct yasm_preproc_lineinfo {
+    /** Nonzero if the line does not directly follow the previous line in
+     * the same file; the remaining members are only set if nonzero.
+     */
+    int changed;
+
+    /** Physical file name of the line. */
+    /*@dependent@*/ const char *filename;
+
+    /** Physical line number of the line. */
+    unsigned long line;
+
+    /** Physical line increment for each following line. */
+    unsigned long line_inc;
+} yasm_preproc_lineinfo;
+
 #ifndef YASM_DOXYGEN
 /** Base #yasm_preproc structure.  Must be present as the first element in any
  * #yasm_preproc implementation.
@@ -106,6 +123,25 @@ typedef struct yasm_preproc_module {
      * Call yasm_preproc_add_standard() instead of calling this function.
      */
     void (*add_standard) (yasm_preproc *preproc, const char **macros);
+
+    /** Module-level implementation of yasm_preproc_get_line_ex().
+     * Call yasm_preproc_get_line_ex() instead of calling this function.
+     * May be NULL if the preprocessor only reports line changes in-band.
+     */
+    char * (*get_line_ex) (yasm_preproc *preproc,
+                           /*@out@*/ yasm_preproc_lineinfo *info);
+
+    /** Module-level implementation of yasm_preproc_add_include_pch().
+     * Call yasm_preproc_add_include_pch() instead of calling this function.
+     * May be NULL if the preprocessor does not support precompiled macros.
+     */
+    void (*add_include_pch) (yasm_preproc *preproc, const char *filename);
+
+    /** Module-level implementation of yasm_preproc_write_pch().
+     * Call yasm_preproc_write_pch() instead of calling this function.
+     * May be NULL if the preprocessor does not support precompiled macros.
+     */
+    void (*write_pch) (yasm_preproc *preproc, FILE *f);
 } yasm_preproc_module;
 
 /** Initialize preprocessor.
@@ -134,6 +170,17 @@ void yasm_preproc_destroy(/*@only@*/ yasm_preproc *preproc);
  */
 char *yasm_preproc_get_line(yasm_preproc *preproc);
 
+/** Gets a single line of preprocessed source code, reporting changes in
+ * source location through info rather than as separate line directives
+ * in the returned text.  Preprocessors without such support behave as
+ * yasm_preproc_get_line() and never set info->changed.
+ * \param preproc       preprocessor
+ * \param info          source location of the returned line (output)
+ * \return Allocated line of code, without the trailing \n.
+ */
+char *yasm_preproc_get_line_ex(yasm_preproc *preproc,
+                               /*@out@*/ yasm_preproc_lineinfo *info);
+
 /** Get the next filename included by the source code.
  * \param preproc       preprocessor
  * \param buf           destination buffer for filename
@@ -178,6 +225,25 @@ void yasm_preproc_define_builtin(yasm_preproc *preproc,
 void yasm_preproc_add_standard(yasm_preproc *preproc,
                                const char **macros);
 
+/** Pre-include a precompiled macro file written by yasm_preproc_write_pch().
+ * The saved macros are used in place of reading the header they were made
+ * from, provided that header, the files it included and the preprocessor
+ * options given before this one are all unchanged; otherwise the header is
+ * pre-included instead.
+ * \param preproc       preprocessor
+ * \param filename      precompiled macro filename
+ */
+void yasm_preproc_add_include_pch(yasm_preproc *preproc,
+                                  const char *filename);
+
+/** Write the macros defined so far to a precompiled macro file.  Should
+ * only be called once all input has been preprocessed.  Errors are stored
+ * into the preprocessor's error/warning set.
+ * \param preproc       preprocessor
+ * \param f             file to write to (opened in binary mode)
+ */
+void yasm_preproc_write_pch(yasm_preproc *preproc, FILE *f);
+
 #ifndef YASM_DOXYGEN
 
 /* Inline macro implementations for preproc functions */
@@ -189,6 +255,11 @@ void yasm_preproc_add_standard(yasm_preproc *preproc,
     ((yasm_preproc_base *)preproc)->module->destroy(preproc)
 #define yasm_preproc_get_line(preproc) \
     ((yasm_preproc_base *)preproc)->module->get_line(preproc)
+#define yasm_preproc_get_line_ex(preproc, info) \
+    (((yasm_preproc_base *)preproc)->module->get_line_ex ? \
+     ((yasm_preproc_base *)preproc)->module->get_line_ex(preproc, info) : \
+     ((info)->changed = 0, \
+      ((yasm_preproc_base *)preproc)->module->get_line(preproc)))
 #define yasm_preproc_get_included_file(preproc, buf, max_size) \
     ((yasm_preproc_base *)preproc)->module->get_included_file(preproc, buf, max_size)
 #define yasm_preproc_add_include_file(preproc, filename) \
@@ -204,6 +275,11 @@ void yasm_preproc_add_standard(yasm_preproc *preproc,
 #define yasm_preproc_add_standard(preproc, macros) \
     ((yasm_preproc_base *)preproc)->module->add_standard(preproc, \
                                                          macros)
+#define yasm_preproc_add_include_pch(preproc, filename) \
+    ((yasm_preproc_base *)preproc)->module->add_include_pch(preproc, \
+                                                            filename)
+#define yasm_preproc_write_pch(preproc, f) \
+    ((yasm_preproc_base *)preproc)->module->write_pch(preproc, f)
 
 #endif
 
@@ -508,6 +508,12 @@ yasm_object_print(const yasm_object *object, FILE *f, int indent_level)
     }
 }
 
+/* Bytecodes are finalized strictly in order.  Although each finalize only
+ * looks at its own bytecode and the previous one, it simplifies expressions
+ * through the shared intnum calculation temporaries and reports problems
+ * through the global pending error and warning state, which is propagated
+ * to errwarns right after each call; it must not run concurrently.
+ */
 void
 yasm_object_finalize(yasm_object *object, yasm_errwarns *errwarns)
 {
@@ -621,6 +627,21 @@ yasm_section_bcs_append(yasm_section *sect, yasm_bytecode *bc)
     return (yasm_bytecode *)NULL;
 }
 
+yasm_bytecode *
+yasm_section_bcs_insert_after(yasm_section *sect, yasm_bytecode *precbc,
+                              yasm_bytecode *bc)
+{
+    if (bc) {
+        if (bc->callback) {
+            bc->section = sect;     /* record parent section */
+            STAILQ_INSERT_AFTER(&sect->bcs, precbc, bc, link);
+            return bc;
+        } else
+            yasm_xfree(bc);
+    }
+    return (yasm_bytecode *)NULL;
+}
+
 int
 yasm_section_bcs_traverse(yasm_section *sect,
                           /*@null@*/ yasm_errwarns *errwarns,
@@ -775,6 +796,11 @@ yasm_section_print(const yasm_section *sect, FILE *f, int indent_level,
  * forward.  In either case, the ongoing offset is updated as well as the
  * lengths of any spans dependent on the offset-setter.
  *
+ * An offset-setter may also have spans of its own (e.g. padding whose length
+ * depends on the length of the bytecodes following it).  When one of these
+ * changes the offset-setter's length, it's handled just like any other
+ * bytecode expansion, starting with the next offset-setter.
+ *
  * Alignment/ORG value is critical value.
  * Cannot be combined with TIMES.
  *
@@ -820,6 +846,8 @@ yasm_section_print(const yasm_section *sect, FILE *f, int indent_level,
  *       If span exceeds long threshold (or is flagged to recalculate on any
  *       change), add it to tail of Q.
  * 3. Final pass over bytecodes to generate final offsets.
+ * 4. Let the bytecode directly preceding each code alignment take up as
+ *    much of the alignment padding as it can (see absorb_align_padding()).
  */
 
 typedef struct yasm_span yasm_span;
@@ -1091,6 +1119,38 @@ update_all_bc_offsets(yasm_object *object, yasm_errwarns *errwarns)
     return saw_error;
 }
 
+/* Shrinks code alignment padding by lengthening the bytecode directly
+ * preceding each code alignment (e.g. with redundant instruction prefixes),
+ * so fewer NOPs end up being executed.  The end of the alignment stays put,
+ * so the only offset that changes is that of the alignment itself; for the
+ * same reason, the preceding bytecode may not have any labels pointing to
+ * its end.  Must be called once all offsets are final.
+ */
+static void
+absorb_align_padding(yasm_object *object)
+{
+    yasm_section *sect;
+
+    STAILQ_FOREACH(sect, &object->sections, link) {
+        yasm_bytecode *prevbc = STAILQ_FIRST(&sect->bcs);
+        yasm_bytecode *bc = STAILQ_NEXT(prevbc, link);
+
+        while (bc) {
+            if (bc->len > 0 && !prevbc->symrecs && !prevbc->multiple &&
+                yasm_bc_is_code_align(bc) && yasm_bc_pad(prevbc, bc->len)) {
+                long neg_thres = 0;
+                long pos_thres = 0;
+
+                bc->offset = yasm_bc_next_offset(prevbc);
+                yasm_bc_expand(bc, 1, 0, (long)bc->offset, &neg_thres,
+                               &pos_thres);
+            }
+            prevbc = bc;
+            bc = STAILQ_NEXT(bc, link);
+        }
+    }
+}
+
 static void
 span_destroy(/*@only@*/ yasm_span *span)
 {
@@ -1440,6 +1500,7 @@ yasm_object_optimize(yasm_object *object, yasm_errwarns *errwarns)
 
     /* Do we need step 2?  If not, go ahead and exit. */
     if (STAILQ_EMPTY(&optd.QB)) {
+        absorb_align_padding(object);
         optimize_cleanup(&optd);
         return;
     }
@@ -1543,6 +1604,8 @@ yasm_object_optimize(yasm_object *object, yasm_errwarns *errwarns)
          *  - offset-setter didn't move its following offset
          */
         os = span->os;
+        if (os->bc == span->bc)
+            os = STAILQ_NEXT(os, link); /* span of an offset-setter itself */
         offset_diff = optd.len_diff;
         while (os->bc && os->bc->section == span->bc->section
                && offset_diff != 0) {
@@ -1577,5 +1640,8 @@ yasm_object_optimize(yasm_object *object, yasm_errwarns *errwarns)
 
     /* Step 3 */
     update_all_bc_offsets(object, errwarns);
+
+    /* Step 4 */
+    absorb_align_padding(object);
     optimize_cleanup(&optd);
 }
@@ -332,6 +332,21 @@ YASM_LIB_DECL
     (yasm_section *sect,
      /*@returned@*/ /*@only@*/ /*@null@*/ yasm_bytecode *bc);
 
+/** Add bytecode to a section, immediately following another bytecode.
+ * \note Does not make a copy of bc; so don't pass this function static or
+ *       local variables, and discard the bc pointer after calling this
+ *       function.
+ * \param sect          section
+ * \param precbc        bytecode (already in sect) to insert after
+ * \param bc            bytecode (may be NULL)
+ * \return If bytecode was actually inserted (it wasn't NULL or empty), the
+ *         bytecode; otherwise NULL.
+ */
+YASM_LIB_DECL
+/*@only@*/ /*@null@*/ yasm_bytecode *yasm_section_bcs_insert_after
+    (yasm_section *sect, yasm_bytecode *precbc,
+     /*@returned@*/ /*@only@*/ /*@null@*/ yasm_bytecode *bc);
+
 /** Traverses all bytecodes in a section, calling a function on each bytecode.
  * \param sect      section
  * \param errwarns  error/warning set (may be NULL)
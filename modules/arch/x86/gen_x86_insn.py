@@ -144,6 +144,26 @@ class Operand(object):
                 self.tmod != other.tmod or
                 self.opt != other.opt)
 
+# Operand classes (see x86_operand_class in x86id.c) accepted by each
+# operand type
+operand_classes = {
+    "Imm": "OPC_Imm", "Imm1": "OPC_Imm", "ImmNotSegOff": "OPC_Imm",
+    "Reg": "OPC_Reg", "Areg": "OPC_Reg", "Creg": "OPC_Reg", "Dreg": "OPC_Reg",
+    "ST0": "OPC_Reg",
+    "RM": "OPC_RM",
+    "Mem": "OPC_Mem", "MemOffs": "OPC_Mem", "MemrAX": "OPC_Mem",
+    "MemEAX": "OPC_Mem", "MemXMMIndex": "OPC_Mem", "MemYMMIndex": "OPC_Mem",
+    "SIMDReg": "OPC_SIMDReg", "XMM0": "OPC_SIMDReg",
+    "SIMDRM": "OPC_SIMDRM",
+    "SegReg": "OPC_SegReg", "CS": "OPC_SegReg", "DS": "OPC_SegReg",
+    "ES": "OPC_SegReg", "FS": "OPC_SegReg", "GS": "OPC_SegReg",
+    "SS": "OPC_SegReg",
+    "CRReg": "OPC_CtlReg", "DRReg": "OPC_CtlReg", "TRReg": "OPC_CtlReg",
+    "CR4": "OPC_CtlReg"}
+
+# Maximum number of operands (X86_MAX_OPERANDS in x86id.c)
+max_operands = 5
+
 class GroupForm(object):
     def __init__(self, **kwargs):
         # Parsers
@@ -368,6 +388,20 @@ class GroupForm(object):
                                 "%d" % len(self.operands),
                                 "%d" % self.all_operands_index]) + " }"
 
+    def match_str(self, index):
+        """Build match index entry (x86_insn_match) initializer for this
+        form, which is at the given index within its group."""
+        opclass = ["OPC(%d, %s)" % (i, operand_classes[op.type])
+                   for i, op in enumerate(self.operands)]
+
+        cpus_str = ["CPU_%s" % x for x in sorted(self.cpu)]
+        cpus_str.extend(["0", "0", "0"])
+
+        return "{ " + ", ".join(["%d" % index,
+                                 "|".join(opclass) or "0",
+                                 "X86_CPU_MASK(%s)" % ", ".join(cpus_str[0:3])
+                                ]) + " }"
+
 groups = {}
 groupnames_ordered = []
 def add_group(name, **kwargs):
@@ -487,6 +521,7 @@ class Insn(object):
         mods_str.extend(["0", "0", "0"])
 
         return ",\t".join(["%s_insn" % self.groupname,
+                           "&%s_insn_index" % self.groupname,
                            "%d" % len(groups[self.groupname]),
                            suffix_str,
                            mods_str[0],
@@ -510,6 +545,7 @@ class Prefix(object):
 
     def __str__(self):
         return ",\t".join(["NULL",
+                           "NULL",
                            "X86_%s>>8" % self.groupname,
                            "0x%02X" % self.value,
                            "0",
@@ -642,6 +678,39 @@ def output_groups(f):
         lprint(",\n    ".join(str(x) for x in groups[name]), f)
         lprint("};\n", f)
 
+        # Match index: forms stably sorted by number of operands, plus the
+        # starting entry for each number of operands.
+        forms = sorted(enumerate(groups[name]),
+                       key=lambda x:len(x[1].operands))
+        if len(forms) > 255:
+            raise ValueError("too many forms in group %s" % name)
+        start = [0] * (max_operands+2)
+        for i, form in forms:
+            if len(form.operands) > max_operands:
+                raise ValueError("too many operands in group %s" % name)
+            for n in range(len(form.operands)+1, max_operands+2):
+                start[n] += 1
+        lprint("static const x86_insn_match %s_insn_match[] = {" % name, f)
+        lprint("   ", f, '')
+        lprint(",\n    ".join(form.match_str(i) for i, form in forms), f)
+        lprint("};\n", f)
+        # Operand types whose match looks at more than the operand class,
+        # size, and register (see x86_match_key in x86id.c)
+        optypes = set(op.type for form in groups[name]
+                      for op in form.operands)
+        index_flags = []
+        if optypes & set(["Imm1"]):
+            index_flags.append("X86_INDEX_IMM1")
+        if optypes & set(["MemOffs"]):
+            index_flags.append("X86_INDEX_MEMOFFS")
+        if optypes & set(["MemrAX", "MemEAX", "MemXMMIndex", "MemYMMIndex"]):
+            index_flags.append("X86_INDEX_MEMREG")
+        lprint("static const x86_insn_index %s_insn_index = {" % name, f)
+        lprint("    {%s}, %s, %s_insn_match" % \
+            (", ".join("%d" % x for x in start),
+             "|".join(index_flags) or "0", name), f)
+        lprint("};\n", f)
+
 #####################################################################
 # General instruction groupings
 #####################################################################
@@ -0,0 +1,20 @@
+[bits 64]
+mov eax, [rbx]
+mov eax, [rbp]
+mov eax, [r13]
+mov eax, [rsp+8]
+mov eax, [r12-1]
+mov eax, [rbx*2]
+mov eax, [2*rsi+4]
+lea rax, [rbx+rcx*4+12]
+lea rax, [rcx*8+rbx]
+lea rax, [rbp+rsp]
+lea rax, [rsp+rbp]
+lea rax, [r8+r15*2+1000]
+lea eax, [ebp+esp*1-128]
+lea eax, [r12d+r13d+127]
+[bits 32]
+mov ecx, [eax]
+mov ecx, [esp+ebp*8+0x12345]
+mov ecx, [ebp+esi]
+mov ecx, [esi*4]
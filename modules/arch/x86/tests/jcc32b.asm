@@ -0,0 +1,31 @@
+[bits 64]
+cpu jccerratum
+top:
+times 28 nop
+jmp top			; no padding needed
+times 29 nop
+cmp rax, rbx		; pair padded as a whole
+jne top
+times 54 nop
+cmp rax, rbx		; doesn't fuse with js; js padded by itself
+js top
+times 24 nop
+call [rax]
+ret
+times 25 nop
+inc ecx			; doesn't fuse with jc
+jc near_away
+times 100 nop
+near_away:
+times 20 nop
+test eax, eax		; padding grows as jump is made near
+jz top
+cpu nojccerratum
+times 22 nop
+jmp top			; crosses, but padding is disabled
+cpu jccerratum
+align 32
+times 29 nop
+cmp eax, 1		; pair padded though an align is between
+align 16
+jne top
@@ -0,0 +1,35 @@
+[bits 32]
+cpu intelnop
+cpu prefixalign
+mov eax, [ebp+4]		; SS prefixes, widened disp
+align 16
+mov eax, [esi+4]		; DS prefixes, widened disp
+align 16
+add eax, 300			; DS prefixes only
+align 16
+lock add [ecx], eax		; existing prefix counts toward limit
+align 16
+add ecx, l1-top			; widened signext imm8
+align 16
+top:
+xor eax, eax
+l1:				; label in the way: NOPs only
+align 16
+jmp eax				; never pad branches
+align 16
+times 3 inc eax			; nor TIMES
+align 16
+mov eax, [fs:0]			; nor existing segment overrides
+align 16
+cpu noprefixalign
+xor eax, eax
+align 16
+
+[bits 64]
+cpu prefixalign
+add rax, [rbx+8]		; CS prefixes in 64-bit mode
+align 16
+mov eax, [rel top]
+align 16
+vaddps ymm0, ymm1, [rax+32]
+align 16
@@ -65,9 +65,8 @@ x86_create(const char *machine, const char *parser,
     /* default to all instructions/features enabled */
     arch_x86->active_cpu = 0;
     arch_x86->cpu_enables_size = 1;
-    arch_x86->cpu_enables = yasm_xmalloc(sizeof(wordptr));
-    arch_x86->cpu_enables[0] = BitVector_Create(64, FALSE);
-    BitVector_Fill(arch_x86->cpu_enables[0]);
+    arch_x86->cpu_enables = yasm_xmalloc(sizeof(x86_cpu_flags));
+    X86_CPU_FILL(&arch_x86->cpu_enables[0]);
 
     arch_x86->amd64_machine = amd64_machine;
     arch_x86->mode_bits = 0;
@@ -75,7 +74,10 @@ x86_create(const char *machine, const char *parser,
     arch_x86->force_strict = 0;
     arch_x86->default_rel = 0;
     arch_x86->gas_intel_mode = 0;
+    arch_x86->jcc_erratum = 0;
+    arch_x86->prefix_align = 0;
     arch_x86->nop = X86_NOP_BASIC;
+    arch_x86->match_cache = NULL;
 
     if (yasm__strcasecmp(parser, "nasm") == 0)
         arch_x86->parser = X86_PARSER_NASM;
@@ -97,10 +99,9 @@ static void
 x86_destroy(/*@only@*/ yasm_arch *arch)
 {
     yasm_arch_x86 *arch_x86 = (yasm_arch_x86 *)arch;
-    unsigned int i;
-    for (i=0; i<arch_x86->cpu_enables_size; i++)
-        BitVector_Destroy(arch_x86->cpu_enables[i]);
     yasm_xfree(arch_x86->cpu_enables);
+    if (arch_x86->match_cache)
+        yasm_xfree(arch_x86->match_cache);
     yasm_xfree(arch);
 }
 
@@ -142,6 +143,8 @@ x86_set_var(yasm_arch *arch, const char *var, unsigned long val)
             arch_x86->default_rel = (unsigned int)val;
     } else if (yasm__strcasecmp(var, "gas_intel_mode") == 0) {
         arch_x86->gas_intel_mode = (unsigned int)val;
+    } else if (yasm__strcasecmp(var, "jcc_erratum") == 0) {
+        arch_x86->jcc_erratum = (unsigned int)val;
     } else
         return 1;
     return 0;
@@ -222,11 +225,9 @@ x86_dir_code64(yasm_object *object, yasm_valparamhead *valparams,
     arch_x86->mode_bits = 64;
 }
 
-static const unsigned char **
-x86_get_fill(const yasm_arch *arch)
+const unsigned char **
+yasm_x86__get_fill(const yasm_arch_x86 *arch_x86, unsigned int mode_bits)
 {
-    const yasm_arch_x86 *arch_x86 = (const yasm_arch_x86 *)arch;
-
     /* Fill patterns that GAS uses. */
     static const unsigned char fill16_1[1] =
         {0x90};                                 /* 1 - nop */
@@ -431,7 +432,7 @@ x86_get_fill(const yasm_arch *arch)
         fill32amd_12,   fill32amd_13,   fill32amd_14,   fill32amd_15
     };
 
-    switch (arch_x86->mode_bits) {
+    switch (mode_bits) {
         case 16:
             return fill16;
         case 32:
@@ -456,6 +457,13 @@ x86_get_fill(const yasm_arch *arch)
     }
 }
 
+static const unsigned char **
+x86_get_fill(const yasm_arch *arch)
+{
+    const yasm_arch_x86 *arch_x86 = (const yasm_arch_x86 *)arch;
+    return yasm_x86__get_fill(arch_x86, arch_x86->mode_bits);
+}
+
 unsigned int
 yasm_x86__get_reg_size(uintptr_t reg)
 {
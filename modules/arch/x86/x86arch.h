@@ -91,6 +91,31 @@
 #define CPU_ADX     57      /* Intel ADCX and ADOX instructions */
 #define CPU_PRFCHW  58      /* Intel/AMD PREFETCHW instruction */
 
+/* Set of enabled CPU feature flags.  All of the CPU_* values above fit in
+ * 64 bits, so this is a fixed-width mask (two 32-bit words) rather than a
+ * BitVector, so instruction availability can be tested with a couple of
+ * ANDs instead of BitVector calls.
+ */
+#define X86_CPU_WORDS   2
+typedef struct x86_cpu_flags {
+    unsigned long w[X86_CPU_WORDS];
+} x86_cpu_flags;
+
+/* Mask for CPU feature n within word w of an x86_cpu_flags.  This is a
+ * constant expression so generated tables can use it in initializers.
+ */
+#define X86_CPU_MASK_WORD(n, w) \
+    ((((n)>>5) == (w)) ? (1UL<<((n)&31)) : 0UL)
+
+#define X86_CPU_EMPTY(s)        ((s)->w[0] = 0, (s)->w[1] = 0)
+#define X86_CPU_FILL(s)         ((s)->w[0] = 0xFFFFFFFFUL, \
+                                 (s)->w[1] = 0xFFFFFFFFUL)
+#define X86_CPU_BIT_ON(s, n)    ((s)->w[(n)>>5] |= 1UL<<((n)&31))
+#define X86_CPU_BIT_OFF(s, n)   ((s)->w[(n)>>5] &= ~(1UL<<((n)&31)))
+#define X86_CPU_BIT_TEST(s, n)  (((s)->w[(n)>>5] >> ((n)&31)) & 1)
+#define X86_CPU_EQUAL(s1, s2)   ((s1)->w[0] == (s2)->w[0] && \
+                                 (s1)->w[1] == (s2)->w[1])
+
 enum x86_parser_type {
     X86_PARSER_NASM = 0,
     X86_PARSER_TASM = 1,
@@ -105,7 +130,7 @@ typedef struct yasm_arch_x86 {
     /* What instructions/features are enabled? */
     unsigned int active_cpu;        /* active index into cpu_enables table */
     unsigned int cpu_enables_size;  /* size of cpu_enables table */
-    wordptr *cpu_enables;
+    x86_cpu_flags *cpu_enables;
 
     unsigned int amd64_machine;
     enum x86_parser_type parser;
@@ -115,6 +140,19 @@ typedef struct yasm_arch_x86 {
     unsigned int default_rel;
     unsigned int gas_intel_mode;
 
+    /* Pad so branches (and macro-fused pairs) stay within 32-byte boundaries
+     * (Intel JCC erratum mitigation).
+     */
+    unsigned int jcc_erratum;
+
+    /* Take up code alignment padding with redundant prefixes and longer
+     * encodings of the preceding instruction rather than NOPs.
+     */
+    unsigned int prefix_align;
+
+    /* Instruction form match cache (see x86id.c); NULL until first used */
+    /*@null@*/ /*@only@*/ struct x86_match_cache *match_cache;
+
     enum {
         X86_NOP_BASIC = 0,
         X86_NOP_INTEL = 1,
@@ -253,6 +291,11 @@ typedef struct x86_insn {
     unsigned char rex;          /* REX AMD64 extension, 0 if none,
                                    0xff if not allowed (high 8 bit reg used) */
 
+    unsigned char prefix_align;     /* 1 if may be lengthened to take up
+                                       following code alignment padding */
+    unsigned char pad_prefix;       /* redundant prefix used as padding */
+    unsigned char num_pad_prefix;   /* number of pad_prefix bytes */
+
     /* Postponed (from parsing to later binding) action options. */
     enum {
         /* None */
@@ -296,6 +339,17 @@ typedef struct x86_jmpfar {
     yasm_value offset;          /* target offset */
 } x86_jmpfar;
 
+/* Padding inserted ahead of branches (or macro-fused compare and branch
+ * pairs) to keep them from crossing or ending on a 32-byte boundary.  The
+ * padded group is the bytecodes following the padding, up to and including
+ * last_bc.  If split is nonzero, only the first of those bytecodes and
+ * last_bc count towards the group length (the ones in between are aligns
+ * that are only empty when the pair is adjacent).
+ */
+/*@only@*/ yasm_bytecode *yasm_x86__bc_create_branch_pad
+    (yasm_bytecode *last_bc, int split, const unsigned char **fill,
+     unsigned long line);
+
 void yasm_x86__bc_transform_insn(yasm_bytecode *bc, x86_insn *insn);
 void yasm_x86__bc_transform_jmp(yasm_bytecode *bc, x86_jmp *jmp);
 void yasm_x86__bc_transform_jmpfar(yasm_bytecode *bc, x86_jmpfar *jmpfar);
@@ -331,6 +385,9 @@ int yasm_x86__intnum_tobytes
 
 unsigned int yasm_x86__get_reg_size(uintptr_t reg);
 
+/*@null@*/ const unsigned char **yasm_x86__get_fill
+    (const yasm_arch_x86 *arch_x86, unsigned int mode_bits);
+
 /*@only@*/ yasm_bytecode *yasm_x86__create_empty_insn(yasm_arch *arch,
                                                       unsigned long line);
 #endif
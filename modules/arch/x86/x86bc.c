@@ -46,6 +46,7 @@ static int x86_bc_insn_tobytes(yasm_bytecode *bc, unsigned char **bufp,
                                unsigned char *bufstart,
                                void *d, yasm_output_value_func output_value,
                                /*@null@*/ yasm_output_reloc_func output_reloc);
+static unsigned long x86_bc_insn_pad(yasm_bytecode *bc, unsigned long len);
 
 static void x86_bc_jmp_destroy(void *contents);
 static void x86_bc_jmp_print(const void *contents, FILE *f, int indent_level);
@@ -71,6 +72,20 @@ static int x86_bc_jmpfar_tobytes
      yasm_output_value_func output_value,
      /*@null@*/ yasm_output_reloc_func output_reloc);
 
+static void x86_bc_branch_pad_destroy(void *contents);
+static void x86_bc_branch_pad_print(const void *contents, FILE *f,
+                                    int indent_level);
+static int x86_bc_branch_pad_calc_len(yasm_bytecode *bc,
+                                      yasm_bc_add_span_func add_span,
+                                      void *add_span_data);
+static int x86_bc_branch_pad_expand(yasm_bytecode *bc, int span, long old_val,
+                                    long new_val, /*@out@*/ long *neg_thres,
+                                    /*@out@*/ long *pos_thres);
+static int x86_bc_branch_pad_tobytes
+    (yasm_bytecode *bc, unsigned char **bufp, unsigned char *bufstart, void *d,
+     yasm_output_value_func output_value,
+     /*@null@*/ yasm_output_reloc_func output_reloc);
+
 /* Bytecode callback structures */
 
 static const yasm_bytecode_callback x86_bc_callback_insn = {
@@ -81,7 +96,8 @@ static const yasm_bytecode_callback x86_bc_callback_insn = {
     x86_bc_insn_calc_len,
     x86_bc_insn_expand,
     x86_bc_insn_tobytes,
-    0
+    0,
+    x86_bc_insn_pad
 };
 
 static const yasm_bytecode_callback x86_bc_callback_jmp = {
@@ -92,7 +108,8 @@ static const yasm_bytecode_callback x86_bc_callback_jmp = {
     x86_bc_jmp_calc_len,
     x86_bc_jmp_expand,
     x86_bc_jmp_tobytes,
-    0
+    0,
+    NULL
 };
 
 static const yasm_bytecode_callback x86_bc_callback_jmpfar = {
@@ -103,9 +120,32 @@ static const yasm_bytecode_callback x86_bc_callback_jmpfar = {
     x86_bc_jmpfar_calc_len,
     yasm_bc_expand_common,
     x86_bc_jmpfar_tobytes,
-    0
+    0,
+    NULL
 };
 
+/* Length depends on its own offset, so it's an offset-setter (like align) */
+static const yasm_bytecode_callback x86_bc_callback_branch_pad = {
+    x86_bc_branch_pad_destroy,
+    x86_bc_branch_pad_print,
+    yasm_bc_finalize_common,
+    NULL,
+    x86_bc_branch_pad_calc_len,
+    x86_bc_branch_pad_expand,
+    x86_bc_branch_pad_tobytes,
+    YASM_BC_SPECIAL_OFFSET,
+    NULL
+};
+
+typedef struct x86_branch_pad {
+    /*@dependent@*/ yasm_bytecode *last_bc; /* last bytecode of padded group */
+    int split;                  /* only first bytecode and last_bc count */
+    const unsigned char **fill;             /* code fill patterns */
+
+    unsigned long offset;       /* current offset of the padding */
+    unsigned long group_len;    /* current length of the padded group */
+} x86_branch_pad;
+
 int
 yasm_x86__set_rex_from_reg(unsigned char *rex, unsigned char *low3,
                            uintptr_t reg, unsigned int bits,
@@ -156,6 +196,21 @@ yasm_x86__bc_transform_jmpfar(yasm_bytecode *bc, x86_jmpfar *jmpfar)
     yasm_bc_transform(bc, &x86_bc_callback_jmpfar, jmpfar);
 }
 
+yasm_bytecode *
+yasm_x86__bc_create_branch_pad(yasm_bytecode *last_bc, int split,
+                               const unsigned char **fill, unsigned long line)
+{
+    x86_branch_pad *pad = yasm_xmalloc(sizeof(x86_branch_pad));
+
+    pad->last_bc = last_bc;
+    pad->split = split;
+    pad->fill = fill;
+    pad->offset = 0;
+    pad->group_len = 0;
+
+    return yasm_bc_create_common(&x86_bc_callback_branch_pad, pad, line);
+}
+
 void
 yasm_x86__ea_init(x86_effaddr *x86_ea, unsigned int spare,
                   yasm_bytecode *precbc)
@@ -384,6 +439,12 @@ x86_bc_jmpfar_destroy(void *contents)
     yasm_xfree(contents);
 }
 
+static void
+x86_bc_branch_pad_destroy(void *contents)
+{
+    yasm_xfree(contents);
+}
+
 void
 yasm_x86__ea_destroy(yasm_effaddr *ea)
 {
@@ -522,6 +583,15 @@ x86_bc_jmpfar_print(const void *contents, FILE *f, int indent_level)
     x86_common_print(&jmpfar->common, f, indent_level);
 }
 
+static void
+x86_bc_branch_pad_print(const void *contents, FILE *f, int indent_level)
+{
+    const x86_branch_pad *pad = (const x86_branch_pad *)contents;
+
+    fprintf(f, "%*s_Branch_Padding_\n", indent_level, "");
+    fprintf(f, "%*sGroup Length=%lu\n", indent_level, "", pad->group_len);
+}
+
 static unsigned int
 x86_common_calc_len(const x86_common *common)
 {
@@ -684,6 +754,117 @@ x86_bc_insn_expand(yasm_bytecode *bc, int span, long old_val, long new_val,
     return 0;
 }
 
+/* Most decoders slow down on instructions with long prefix chains, so
+ * never use padding prefixes to take an instruction past this many legacy
+ * prefixes in total (the same limit GNU as uses for branch alignment).
+ */
+#define X86_MAX_PAD_PREFIXES    5
+
+/* Determine which redundant segment prefix can be put in front of an
+ * instruction without changing its meaning, or 0 if there isn't one.
+ */
+static unsigned char
+x86_insn_pad_prefix(const x86_insn *insn)
+{
+    const x86_effaddr *x86_ea = insn->x86_ea;
+    unsigned int addrsize, mod, rm, base;
+
+    /* Leave branches alone: CS and DS prefixes are branch hints or CET
+     * "notrack" on them.
+     */
+    if (insn->special_prefix != 0xC4 && insn->special_prefix != 0xC5 &&
+        insn->special_prefix != 0x8F && insn->opcode.len == 1) {
+        switch (insn->opcode.opcode[0]) {
+            case 0xC2: case 0xC3: case 0xCA: case 0xCB: case 0xCF:
+                return 0;
+            case 0xFF:
+                if (x86_ea && ((x86_ea->modrm >> 3) & 7) >= 2 &&
+                    ((x86_ea->modrm >> 3) & 7) <= 5)
+                    return 0;
+                break;
+        }
+    }
+
+    if (x86_ea) {
+        if (x86_ea->ea.segreg != 0)
+            return 0;
+        if (x86_ea->need_modrm && !x86_ea->valid_modrm)
+            return 0;
+        if (x86_ea->need_sib == 0xff ||
+            (x86_ea->need_sib && !x86_ea->valid_sib))
+            return 0;
+    }
+
+    /* CS, DS, ES, and SS overrides are ignored in 64-bit mode */
+    if (insn->common.mode_bits == 64)
+        return 0x2E;
+
+    /* Otherwise use an override matching the default segment of the memory
+     * operand: SS for BP/SP-based addresses, DS for everything else.
+     */
+    if (!x86_ea || !x86_ea->need_modrm || (x86_ea->modrm >> 6) == 3)
+        return 0x3E;
+
+    addrsize = insn->common.addrsize ? insn->common.addrsize :
+        insn->common.mode_bits;
+    mod = x86_ea->modrm >> 6;
+    rm = x86_ea->modrm & 7;
+    if (addrsize == 16) {
+        if (rm == 2 || rm == 3 || (rm == 6 && mod != 0))
+            return 0x36;
+    } else if (rm == 4) {
+        base = x86_ea->sib & 7;
+        if (base == 4 || (base == 5 && mod != 0))
+            return 0x36;
+    } else if (rm == 5 && mod != 0)
+        return 0x36;
+    return 0x3E;
+}
+
+static unsigned long
+x86_bc_insn_pad(yasm_bytecode *bc, unsigned long len)
+{
+    x86_insn *insn = (x86_insn *)bc->contents;
+    x86_effaddr *x86_ea = insn->x86_ea;
+    unsigned long orig_len = bc->len;
+    unsigned int num_prefix;
+    long neg_thres = 0;
+    long pos_thres = 0;
+
+    if (!insn->prefix_align || insn->num_pad_prefix != 0)
+        return 0;
+
+    insn->pad_prefix = x86_insn_pad_prefix(insn);
+    if (insn->pad_prefix == 0)
+        return 0;
+
+    /* Use the word-sized displacement and immediate forms where they fit */
+    if (x86_ea && x86_ea->ea.disp.size == 8) {
+        unsigned long grow = (insn->common.addrsize == 16) ? 1 : 3;
+        if (grow <= len && bc->len + grow <= 15)
+            x86_bc_insn_expand(bc, 1, 0, 0, &neg_thres, &pos_thres);
+    }
+    if (insn->imm && insn->postop == X86_POSTOP_SIGNEXT_IMM8) {
+        unsigned long grow = insn->imm->size/8 - insn->opcode.len;
+        if (grow <= len - (bc->len - orig_len) && bc->len + grow <= 15)
+            x86_bc_insn_expand(bc, 2, 0, 0, &neg_thres, &pos_thres);
+    }
+
+    /* Make up the rest with redundant prefixes */
+    num_prefix = x86_common_calc_len(&insn->common);
+    if (insn->special_prefix != 0 && insn->special_prefix != 0xC4 &&
+        insn->special_prefix != 0xC5 && insn->special_prefix != 0x8F)
+        num_prefix++;
+    while (bc->len - orig_len < len && bc->len < 15 &&
+           num_prefix < X86_MAX_PAD_PREFIXES) {
+        insn->num_pad_prefix++;
+        num_prefix++;
+        bc->len++;
+    }
+
+    return bc->len - orig_len;
+}
+
 static int
 x86_bc_jmp_calc_len(yasm_bytecode *bc, yasm_bc_add_span_func add_span,
                     void *add_span_data)
@@ -784,6 +965,90 @@ x86_bc_jmp_expand(yasm_bytecode *bc, int span, long old_val, long new_val,
     return 0;
 }
 
+/* Number of bytes of padding needed at offset so that a group of group_len
+ * bytes following it neither crosses nor ends on a 32-byte boundary.
+ */
+static unsigned long
+x86_branch_pad_len(unsigned long offset, unsigned long group_len)
+{
+    unsigned long start = offset & 31;
+
+    if (group_len == 0 || group_len >= 32 || start + group_len < 32)
+        return 0;
+    return 32 - start;
+}
+
+static int
+x86_bc_branch_pad_calc_len(yasm_bytecode *bc, yasm_bc_add_span_func add_span,
+                           void *add_span_data)
+{
+    x86_branch_pad *pad = (x86_branch_pad *)bc->contents;
+    yasm_value group_len;
+
+    pad->offset = bc->offset;
+    pad->group_len = 0;
+
+    if (!add_span)
+        return 0;
+
+    /* The padding also depends on the length of the group following it
+     * (e.g. a jump being upgraded from short to near), so track that length
+     * as a span that updates on any change.
+     */
+    if (pad->split) {
+        /* Length of the first bytecode plus that of last_bc.  Leaving out
+         * the aligns in between keeps this padding from depending on
+         * them (they depend on it), and last_bc's own padding fits the
+         * case where they aren't empty.
+         */
+        yasm_bytecode *first_bc = STAILQ_NEXT(bc, link);
+        yasm_bytecode *prev_bc = first_bc;
+
+        while (STAILQ_NEXT(prev_bc, link) != pad->last_bc)
+            prev_bc = STAILQ_NEXT(prev_bc, link);
+        yasm_value_initialize(&group_len,
+            yasm_expr_create(YASM_EXPR_ADD,
+                yasm_expr_expr(yasm_expr_create(YASM_EXPR_SUB,
+                    yasm_expr_precbc(first_bc), yasm_expr_precbc(bc),
+                    bc->line)),
+                yasm_expr_expr(yasm_expr_create(YASM_EXPR_SUB,
+                    yasm_expr_precbc(pad->last_bc), yasm_expr_precbc(prev_bc),
+                    bc->line)),
+                bc->line), 0);
+    } else
+        yasm_value_initialize(&group_len,
+            yasm_expr_create(YASM_EXPR_SUB, yasm_expr_precbc(pad->last_bc),
+                             yasm_expr_precbc(bc), bc->line), 0);
+    add_span(add_span_data, bc, -1, &group_len, 0, 0);
+    yasm_value_delete(&group_len);
+    return 0;
+}
+
+static int
+x86_bc_branch_pad_expand(yasm_bytecode *bc, int span, long old_val,
+                         long new_val, /*@out@*/ long *neg_thres,
+                         /*@out@*/ long *pos_thres)
+{
+    x86_branch_pad *pad = (x86_branch_pad *)bc->contents;
+
+    switch (span) {
+        case -1:
+            /* Length of the padded group changed */
+            pad->group_len = (unsigned long)new_val;
+            bc->len = x86_branch_pad_len(pad->offset, pad->group_len);
+            break;
+        case 1:
+            /* Offset of the padding changed */
+            pad->offset = (unsigned long)new_val;
+            bc->len = x86_branch_pad_len(pad->offset, pad->group_len);
+            *pos_thres = (long)(pad->offset + bc->len);
+            break;
+        default:
+            yasm_internal_error(N_("unrecognized span id"));
+    }
+    return 1;
+}
+
 static int
 x86_bc_jmpfar_calc_len(yasm_bytecode *bc, yasm_bc_add_span_func add_span,
                        void *add_span_data)
@@ -838,8 +1103,11 @@ x86_bc_insn_tobytes(yasm_bytecode *bc, unsigned char **bufp,
     x86_insn *insn = (x86_insn *)bc->contents;
     /*@null@*/ x86_effaddr *x86_ea = (x86_effaddr *)insn->x86_ea;
     yasm_value *imm = insn->imm;
+    unsigned int i;
 
     /* Prefixes */
+    for (i=0; i<insn->num_pad_prefix; i++)
+        YASM_WRITE_8(*bufp, insn->pad_prefix);
     x86_common_tobytes(&insn->common, bufp,
                        x86_ea ? (unsigned int)(x86_ea->ea.segreg>>8) : 0);
     if (insn->special_prefix != 0)
@@ -1051,6 +1319,38 @@ x86_bc_jmpfar_tobytes(yasm_bytecode *bc, unsigned char **bufp,
     return 0;
 }
 
+static int
+x86_bc_branch_pad_tobytes(yasm_bytecode *bc, unsigned char **bufp,
+                          unsigned char *bufstart, void *d,
+                          yasm_output_value_func output_value,
+                          /*@unused@*/ yasm_output_reloc_func output_reloc)
+{
+    x86_branch_pad *pad = (x86_branch_pad *)bc->contents;
+    unsigned long len = bc->len;
+    unsigned long maxlen = 15;
+
+    if (len == 0)
+        return 0;
+
+    /* Don't use the jmp-over fill patterns; they're branches themselves. */
+    while (maxlen > 0 && (!pad->fill[maxlen] || pad->fill[maxlen][0] == 0xeb))
+        maxlen--;
+    if (maxlen == 0) {
+        yasm_error_set(YASM_ERROR_GENERAL,
+                       N_("could not find any code alignment size"));
+        return 1;
+    }
+
+    while (len > maxlen) {
+        memcpy(*bufp, pad->fill[maxlen], maxlen);
+        *bufp += maxlen;
+        len -= maxlen;
+    }
+    memcpy(*bufp, pad->fill[len], len);
+    *bufp += len;
+    return 0;
+}
+
 int
 yasm_x86__intnum_tobytes(yasm_arch *arch, const yasm_intnum *intn,
                          unsigned char *buf, size_t destsize, size_t valsize,
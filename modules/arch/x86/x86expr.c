@@ -426,6 +426,128 @@ x86_expr_checkea_getregusage(yasm_expr **ep, /*@null@*/ int *indexreg,
     return 0;
 }
 
+/* Fast path for the common simple 32/64-bit memory expression forms:
+ * [base], [base+disp], [base+index*scale+disp], [index*scale+disp], etc,
+ * where every term is a register, an integer, or a reg*int multiplication.
+ * As yasm_insn_finalize() has already leveled the expression, these can be
+ * decomposed directly without the general machinery in
+ * x86_expr_checkea_getregusage() (leveling, register distribution, and
+ * re-simplification).
+ *
+ * Fills in the register multipliers and index register exactly as
+ * x86_expr_checkea_getregusage() would, and replaces the expression with
+ * just the displacement.  Returns 1 if successful, 0 if the expression
+ * isn't one of the simple forms (in which case nothing has been changed).
+ */
+static int
+x86_expr_checkea_simple(yasm_expr **ep, int *indexreg, int *regmult,
+                        unsigned int addrsize)
+{
+    yasm_expr *e = *ep;
+    unsigned long regsize = (addrsize == 64) ? X86_REG64 : X86_REG32;
+    /*@null@*/ yasm_intnum *disp = NULL;
+    int indexval = 0;
+    int indexmult = 0;
+    int i;
+
+    if (e->op != YASM_EXPR_IDENT && e->op != YASM_EXPR_ADD &&
+        e->op != YASM_EXPR_MUL)
+        return 0;
+
+    /* Handle the [index*scale] case by treating it as a single term */
+    if (e->op == YASM_EXPR_MUL) {
+        if (e->numterms != 2)
+            return 0;
+        i = 1;
+    } else
+        i = e->numterms;
+
+    /* First pass: check the form without changing anything */
+    while (i-- > 0) {
+        const yasm_expr *sub = e;
+        int regterm, intterm;
+
+        if (e->op != YASM_EXPR_MUL) {
+            switch (e->terms[i].type) {
+                case YASM_EXPR_REG:
+                    if ((e->terms[i].data.reg & ~0xFUL) != regsize)
+                        return 0;
+                    continue;
+                case YASM_EXPR_INT:
+                    if (disp)
+                        return 0;
+                    disp = e->terms[i].data.intn;
+                    continue;
+                case YASM_EXPR_EXPR:
+                    sub = e->terms[i].data.expn;
+                    if (sub->op != YASM_EXPR_MUL || sub->numterms != 2)
+                        return 0;
+                    break;
+                default:
+                    return 0;
+            }
+        }
+
+        /* reg*int (in either order) with a positive multiplier */
+        regterm = (sub->terms[0].type == YASM_EXPR_REG) ? 0 : 1;
+        intterm = 1-regterm;
+        if (sub->terms[regterm].type != YASM_EXPR_REG ||
+            sub->terms[intterm].type != YASM_EXPR_INT ||
+            (sub->terms[regterm].data.reg & ~0xFUL) != regsize ||
+            yasm_intnum_sign(sub->terms[intterm].data.intn) <= 0 ||
+            !yasm_intnum_in_range(sub->terms[intterm].data.intn, 1, 8))
+            return 0;
+    }
+
+    /* Second pass: accumulate register usage, in the same order (and with
+     * the same index register selection) as x86_expr_checkea_getregusage().
+     */
+    for (i=0; i<e->numterms; i++) {
+        const yasm_expr *sub;
+        int regterm, regnum;
+        long delta;
+
+        if (e->op == YASM_EXPR_MUL)
+            sub = e;
+        else if (e->terms[i].type == YASM_EXPR_REG) {
+            regnum = (int)(e->terms[i].data.reg & 0xF);
+            regmult[regnum]++;
+            /* Let last, largest multipler win indexreg */
+            if (regmult[regnum] > 0 && indexval <= regmult[regnum] &&
+                !indexmult) {
+                *indexreg = regnum;
+                indexval = regmult[regnum];
+            }
+            continue;
+        } else if (e->terms[i].type == YASM_EXPR_EXPR)
+            sub = e->terms[i].data.expn;
+        else
+            continue;
+
+        regterm = (sub->terms[0].type == YASM_EXPR_REG) ? 0 : 1;
+        regnum = (int)(sub->terms[regterm].data.reg & 0xF);
+        delta = yasm_intnum_get_int(sub->terms[1-regterm].data.intn);
+        regmult[regnum] += delta;
+        if (e->op == YASM_EXPR_MUL) {
+            *indexreg = regnum;
+            break;
+        }
+        /* Let last, largest multipler win indexreg */
+        if (indexval <= regmult[regnum]) {
+            *indexreg = regnum;
+            indexval = regmult[regnum];
+            indexmult = 1;
+        }
+    }
+
+    /* Replace expression with just the displacement */
+    *ep = yasm_expr_create_ident(yasm_expr_int(disp ? yasm_intnum_copy(disp) :
+                                               yasm_intnum_create_uint(0)),
+                                 e->line);
+    yasm_expr_destroy(e);
+    return 1;
+}
+
 /* Calculate the displacement length, if possible.
  * Takes several extra inputs so it can be used by both 32-bit and 16-bit
  * expressions:
@@ -693,7 +815,11 @@ yasm_x86__expr_checkea(x86_effaddr *x86_ea, unsigned char *addrsize,
         reg3264_data.vsib_mode = x86_ea->vsib_mode;
         reg3264_data.bits = bits;
         reg3264_data.addrsize = *addrsize;
-        if (x86_ea->ea.disp.abs) {
+        if (x86_ea->ea.disp.abs && x86_ea->vsib_mode == 0 &&
+            x86_expr_checkea_simple(&x86_ea->ea.disp.abs, &indexreg,
+                                    reg3264mult, *addrsize))
+            ;
+        else if (x86_ea->ea.disp.abs) {
             int pcrel = 0;
             switch (x86_expr_checkea_getregusage
                     (&x86_ea->ea.disp.abs, &indexreg, &pcrel, bits,
@@ -299,14 +299,80 @@ typedef struct x86_insn_info {
     unsigned int operands_index:12;
 } x86_insn_info;
 
+/* Operand classes, used to quickly filter out instruction forms that can't
+ * possibly match the instruction's operands before doing the full per-operand
+ * checks in x86_find_match().  Each operand of an instruction falls into
+ * exactly one class; each operand of an instruction form accepts one or more
+ * classes.  Classes for operand N are shifted left by N*OPC_BITS.
+ */
+enum x86_operand_class {
+    OPC_Imm = 1<<0,         /* immediate */
+    OPC_Mem = 1<<1,         /* memory */
+    OPC_SegReg = 1<<2,      /* segment register */
+    OPC_Reg = 1<<3,         /* general purpose or FPU register */
+    OPC_SIMDReg = 1<<4,     /* MMX, XMM, or YMM register */
+    OPC_CtlReg = 1<<5,      /* CR, DR, or TR register */
+    OPC_RM = OPC_Reg|OPC_Mem,
+    OPC_SIMDRM = OPC_SIMDReg|OPC_Mem
+};
+#define OPC_BITS        6
+#define OPC(n, c)       ((unsigned long)(c) << ((n)*OPC_BITS))
+
+/* Maximum number of operands of an instruction (and instruction form) */
+#define X86_MAX_OPERANDS    5
+
+/* Precomputed match data for a single instruction form. */
+typedef struct x86_insn_match {
+    /* index of the form in the group's x86_insn_info array */
+    unsigned char info;
+
+    /* operand classes accepted by each operand (OPC(n, OPC_xxx) OR'ed) */
+    unsigned long opclass;
+
+    /* cpu0|cpu1|cpu2 of the form as a fixed-width mask */
+    unsigned long cpu[X86_CPU_WORDS];
+} x86_insn_match;
+
+/* Per-group match index, generated alongside each x86_insn_info group.
+ * The match entries are sorted (stably, so first match still wins) by
+ * number of operands; the entries for forms taking N operands are
+ * match[start[N]] through match[start[N+1]-1].
+ */
+typedef struct x86_insn_index {
+    unsigned char start[X86_MAX_OPERANDS+2];
+    unsigned char flags;        /* X86_INDEX_* flags */
+    const x86_insn_match *match;
+} x86_insn_index;
+
+/* x86_insn_index flags: the group contains forms with operand types that
+ * look at more than the operand class, size, and register.
+ */
+enum x86_insn_index_flags {
+    X86_INDEX_IMM1 = 1<<0,      /* OPT_Imm1 (immediate value) */
+    X86_INDEX_MEMOFFS = 1<<1,   /* OPT_MemOffs (registers in EA) */
+    /* OPT_MemrAX, OPT_MemEAX, OPT_MemXMMIndex, OPT_MemYMMIndex (specific
+     * registers in EA)
+     */
+    X86_INDEX_MEMREG = 1<<2
+};
+
+#define X86_CPU_MASK(cpu0, cpu1, cpu2) \
+    {X86_CPU_MASK_WORD(cpu0, 0)|X86_CPU_MASK_WORD(cpu1, 0)| \
+     X86_CPU_MASK_WORD(cpu2, 0), \
+     X86_CPU_MASK_WORD(cpu0, 1)|X86_CPU_MASK_WORD(cpu1, 1)| \
+     X86_CPU_MASK_WORD(cpu2, 1)}
+
 typedef struct x86_id_insn {
     yasm_insn insn;     /* base structure */
 
     /* instruction parse group - NULL if empty instruction (just prefixes) */
     /*@null@*/ const x86_insn_info *group;
 
+    /* match index for the instruction parse group */
+    const x86_insn_index *index;
+
     /* CPU feature flags enabled at the time of parsing the instruction */
-    wordptr cpu_enabled;
+    x86_cpu_flags cpu_enabled;
 
     /* Modifier data */
     unsigned char mod_data[3];
@@ -331,8 +397,42 @@ typedef struct x86_id_insn {
 
     /* Default rel setting at the time of parsing the instruction */
     unsigned int default_rel:1;
+
+    /* JCC erratum padding setting at the time of parsing the instruction */
+    unsigned int jcc_erratum:1;
+
+    /* Prefix alignment padding setting at the time of parsing the
+     * instruction
+     */
+    unsigned int prefix_align:1;
 } x86_id_insn;
 
+/* Instruction form match cache.  Hot code tends to repeat the same handful
+ * of instruction forms many times, so the result of x86_find_match() is
+ * remembered per object (in a small direct-mapped table hung off the arch)
+ * keyed on everything the match depends on: the group, parser state, and
+ * the "shape" of each operand.  Register operands are normalized to their
+ * class (plus the few register numbers that specific operand types check
+ * for), so e.g. "add reg, imm8" hits regardless of the register used.
+ */
+#define X86_MATCH_CACHE_SIZE    256
+
+typedef struct x86_match_key {
+    const x86_insn_info *group;
+    unsigned long cpu[X86_CPU_WORDS];
+    unsigned long flags;        /* mode_bits, suffix, misc_flags, etc */
+    unsigned long ops[X86_MAX_OPERANDS];
+} x86_match_key;
+
+typedef struct x86_match_cache_entry {
+    x86_match_key key;
+    /*@null@*/ const x86_insn_info *info;
+} x86_match_cache_entry;
+
+struct x86_match_cache {
+    x86_match_cache_entry entries[X86_MATCH_CACHE_SIZE];
+};
+
 static void x86_id_insn_destroy(void *contents);
 static void x86_id_insn_print(const void *contents, FILE *f, int indent_level);
 static void x86_id_insn_finalize(yasm_bytecode *bc, yasm_bytecode *prev_bc);
@@ -345,7 +445,8 @@ static const yasm_bytecode_callback x86_id_insn_callback = {
     yasm_bc_calc_len_common,
     yasm_bc_expand_common,
     yasm_bc_tobytes_common,
-    YASM_BC_SPECIAL_INSN
+    YASM_BC_SPECIAL_INSN,
+    NULL
 };
 
 #include "x86insns.c"
@@ -564,9 +665,9 @@ x86_finalize_jmp(yasm_bytecode *bc, yasm_bytecode *prev_bc,
         if (mode_bits == 64 && (info->misc_flags & NOT_64))
             continue;
 
-        if (!BitVector_bit_test(id_insn->cpu_enabled, info->cpu0) ||
-            !BitVector_bit_test(id_insn->cpu_enabled, info->cpu1) ||
-            !BitVector_bit_test(id_insn->cpu_enabled, info->cpu2))
+        if (!X86_CPU_BIT_TEST(&id_insn->cpu_enabled, info->cpu0) ||
+            !X86_CPU_BIT_TEST(&id_insn->cpu_enabled, info->cpu1) ||
+            !X86_CPU_BIT_TEST(&id_insn->cpu_enabled, info->cpu2))
             continue;
 
         if (info->num_operands == 0)
@@ -621,29 +722,86 @@ x86_finalize_jmp(yasm_bytecode *bc, yasm_bytecode *prev_bc,
     yasm_x86__bc_transform_jmp(bc, jmp);
 }
 
+/* Determine the operand class (see x86_operand_class) of an operand. */
+static unsigned long
+x86_operand_class(const yasm_insn_operand *op)
+{
+    switch (op->type) {
+        case YASM_INSN__OPERAND_IMM:
+            return OPC_Imm;
+        case YASM_INSN__OPERAND_MEMORY:
+            return OPC_Mem;
+        case YASM_INSN__OPERAND_SEGREG:
+            return OPC_SegReg;
+        case YASM_INSN__OPERAND_REG:
+            switch ((x86_expritem_reg_size)(op->data.reg&~0xFUL)) {
+                case X86_REG8:
+                case X86_REG8X:
+                case X86_REG16:
+                case X86_REG32:
+                case X86_REG64:
+                case X86_FPUREG:
+                    return OPC_Reg;
+                case X86_MMXREG:
+                case X86_XMMREG:
+                case X86_YMMREG:
+                    return OPC_SIMDReg;
+                case X86_CRREG:
+                case X86_DRREG:
+                case X86_TRREG:
+                    return OPC_CtlReg;
+                default:
+                    break;
+            }
+            break;
+    }
+    /* Unknown; don't filter on it (full matching will reject it). */
+    return 0;
+}
+
 static const x86_insn_info *
 x86_find_match(x86_id_insn *id_insn, yasm_insn_operand **ops,
                yasm_insn_operand **rev_ops, const unsigned int *size_lookup,
                int bypass)
 {
-    const x86_insn_info *info = id_insn->group;
-    unsigned int num_info = id_insn->num_info;
+    const x86_insn_index *index = id_insn->index;
+    const x86_insn_match *match, *match_end;
+    const x86_insn_info *info = NULL;
+    unsigned int num_operands = id_insn->insn.num_operands;
     unsigned int suffix = id_insn->suffix;
     unsigned int mode_bits = id_insn->mode_bits;
+    const unsigned long *cpu_enabled = id_insn->cpu_enabled.w;
+    unsigned long opclass = 0, rev_opclass = 0;
     int found = 0;
+    unsigned int i;
 
-    /* Just do a simple linear search through the info array for a match.
-     * First match wins.
+    if (num_operands > X86_MAX_OPERANDS)
+        return NULL;
+
+    /* Build operand class signatures for the normal and (GAS) reversed
+     * operand orders.
+     */
+    for (i = 0; i < num_operands; i++) {
+        opclass |= OPC(i, x86_operand_class(ops[i]));
+        if (id_insn->parser == X86_PARSER_GAS)
+            rev_opclass |= OPC(i, x86_operand_class(rev_ops[i]));
+    }
+
+    /* Do a linear search through the forms of the group taking this number
+     * of operands (in original group order).  First match wins.
      */
-    for (; num_info>0 && !found; num_info--, info++) {
+    match = &index->match[index->start[num_operands]];
+    match_end = &index->match[index->start[num_operands+1]];
+    for (; match != match_end && !found; match++) {
         yasm_insn_operand *op, **use_ops;
-        const x86_info_operand *info_ops =
-            &insn_operands[info->operands_index];
-        unsigned int gas_flags = info->gas_flags;
-        unsigned int misc_flags = info->misc_flags;
+        const x86_info_operand *info_ops;
+        unsigned int gas_flags, misc_flags;
         unsigned int size;
         int mismatch = 0;
-        unsigned int i;
+
+        info = &id_insn->group[match->info];
+        gas_flags = info->gas_flags;
+        misc_flags = info->misc_flags;
 
         /* Match CPU */
         if (mode_bits != 64 && (misc_flags & ONLY_64))
@@ -652,13 +810,8 @@ x86_find_match(x86_id_insn *id_insn, yasm_insn_operand **ops,
             continue;
 
         if (bypass != 8 &&
-            (!BitVector_bit_test(id_insn->cpu_enabled, info->cpu0) ||
-             !BitVector_bit_test(id_insn->cpu_enabled, info->cpu1) ||
-             !BitVector_bit_test(id_insn->cpu_enabled, info->cpu2)))
-            continue;
-
-        /* Match # of operands */
-        if (id_insn->insn.num_operands != info->num_operands)
+            ((match->cpu[0] & ~cpu_enabled[0]) |
+             (match->cpu[1] & ~cpu_enabled[1])) != 0)
             continue;
 
         /* Match AVX */
@@ -680,14 +833,20 @@ x86_find_match(x86_id_insn *id_insn, yasm_insn_operand **ops,
 
         /* Use reversed operands in GAS mode if not otherwise specified */
         use_ops = ops;
-        if (id_insn->parser == X86_PARSER_GAS && !(gas_flags & GAS_NO_REV))
+        if (id_insn->parser == X86_PARSER_GAS && !(gas_flags & GAS_NO_REV)) {
             use_ops = rev_ops;
+            if ((match->opclass & rev_opclass) != rev_opclass)
+                continue;
+        } else if ((match->opclass & opclass) != opclass)
+            continue;
 
-        if (id_insn->insn.num_operands == 0) {
+        if (num_operands == 0) {
             found = 1;      /* no operands -> must have a match here. */
             break;
         }
 
+        info_ops = &insn_operands[info->operands_index];
+
         /* Match each operand type and size */
         for (i = 0, op = use_ops[0]; op && i<info->num_operands && !mismatch;
              op = use_ops[++i]) {
@@ -997,24 +1156,159 @@ x86_find_match(x86_id_insn *id_insn, yasm_insn_operand **ops,
     return info;
 }
 
+/* Build the match cache key for an instruction.  Returns 0 if the
+ * instruction can't be cached.
+ */
+static int
+x86_match_key_build(x86_match_key *key, const x86_id_insn *id_insn,
+                    yasm_insn_operand **ops)
+{
+    unsigned int flags = id_insn->index->flags;
+    unsigned int i;
+
+    key->group = id_insn->group;
+    key->cpu[0] = id_insn->cpu_enabled.w[0];
+    key->cpu[1] = id_insn->cpu_enabled.w[1];
+    key->flags = (unsigned long)id_insn->mode_bits
+        | ((unsigned long)id_insn->suffix << 8)
+        | ((unsigned long)id_insn->misc_flags << 17)
+        | ((unsigned long)id_insn->parser << 22)
+        | ((unsigned long)id_insn->default_rel << 24)
+        | ((unsigned long)id_insn->insn.num_operands << 25);
+
+    for (i = 0; i < X86_MAX_OPERANDS; i++) {
+        const yasm_insn_operand *op = ops[i];
+        unsigned long shape;
+
+        key->ops[i] = 0;
+        if (i >= id_insn->insn.num_operands)
+            continue;
+        if (op->size > 0x1FF || op->targetmod > 0xF)
+            return 0;
+
+        /* bits 0-2: type, 3-11: size, 12-15: target modifier,
+         * 16+: type-specific
+         */
+        shape = op->type | (op->size << 3) | (op->targetmod << 12);
+        switch (op->type) {
+            case YASM_INSN__OPERAND_REG:
+            {
+                /* Only register numbers 0-2 (Areg, Creg, Dreg, ST0, XMM0)
+                 * and 4 (CR4) are looked at specifically.
+                 */
+                unsigned long regnum = op->data.reg & 0xF;
+                if (regnum > 4)
+                    regnum = 0xF;
+                shape |= ((op->data.reg & 0xF0) | regnum) << 16;
+                break;
+            }
+            case YASM_INSN__OPERAND_SEGREG:
+                shape |= (op->data.reg & 0xF) << 16;
+                break;
+            case YASM_INSN__OPERAND_MEMORY:
+            {
+                const yasm_effaddr *ea = op->data.ea;
+                if (flags & X86_INDEX_MEMREG)
+                    return 0;
+                shape |= ((unsigned long)ea->disp.size << 16)
+                    | ((unsigned long)ea->pc_rel << 24)
+                    | ((unsigned long)ea->not_pc_rel << 25);
+                if ((flags & X86_INDEX_MEMOFFS) &&
+                    yasm_expr__contains(ea->disp.abs, YASM_EXPR_REG))
+                    shape |= 1UL<<26;
+                break;
+            }
+            case YASM_INSN__OPERAND_IMM:
+                if (op->seg)
+                    shape |= 1UL<<16;
+                if (flags & X86_INDEX_IMM1) {
+                    yasm_insn_operand *imm_op = ops[i];
+                    const yasm_intnum *num =
+                        yasm_expr_get_intnum(&imm_op->data.val, 0);
+                    if (num && yasm_intnum_is_pos1(num))
+                        shape |= 1UL<<17;
+                }
+                break;
+        }
+        key->ops[i] = shape;
+    }
+    return 1;
+}
+
+static x86_match_cache_entry *
+x86_match_cache_lookup(struct x86_match_cache *cache,
+                       const x86_match_key *key)
+{
+    unsigned long hash = (unsigned long)(uintptr_t)key->group;
+    unsigned int i;
+
+    hash ^= key->flags * 31;
+    for (i = 0; i < X86_MAX_OPERANDS; i++)
+        hash = hash * 33 + key->ops[i];
+    hash ^= hash >> 16;
+    return &cache->entries[hash % X86_MATCH_CACHE_SIZE];
+}
+
+static int
+x86_match_key_equal(const x86_match_key *k1, const x86_match_key *k2)
+{
+    unsigned int i;
+    if (k1->group != k2->group || k1->flags != k2->flags ||
+        k1->cpu[0] != k2->cpu[0] || k1->cpu[1] != k2->cpu[1])
+        return 0;
+    for (i = 0; i < X86_MAX_OPERANDS; i++) {
+        if (k1->ops[i] != k2->ops[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* Find a match for an instruction, using (and filling) the match cache
+ * when available.
+ */
+static const x86_insn_info *
+x86_find_match_cached(yasm_bytecode *bc, x86_id_insn *id_insn,
+                      yasm_insn_operand **ops, yasm_insn_operand **rev_ops,
+                      const unsigned int *size_lookup)
+{
+    yasm_arch_x86 *arch_x86;
+    x86_match_cache_entry *entry;
+    x86_match_key key;
+    const x86_insn_info *info;
+
+    if (!bc->section ||
+        !x86_match_key_build(&key, id_insn, ops))
+        return x86_find_match(id_insn, ops, rev_ops, size_lookup, 0);
+
+    arch_x86 = (yasm_arch_x86 *)yasm_section_get_object(bc->section)->arch;
+    if (!arch_x86->match_cache) {
+        arch_x86->match_cache = yasm_xmalloc(sizeof(struct x86_match_cache));
+        memset(arch_x86->match_cache, 0, sizeof(struct x86_match_cache));
+    }
+
+    entry = x86_match_cache_lookup(arch_x86->match_cache, &key);
+    if (entry->info && x86_match_key_equal(&entry->key, &key))
+        return entry->info;
+
+    info = x86_find_match(id_insn, ops, rev_ops, size_lookup, 0);
+    if (info) {
+        entry->key = key;
+        entry->info = info;
+    }
+    return info;
+}
+
 static void
 x86_match_error(x86_id_insn *id_insn, yasm_insn_operand **ops,
                 yasm_insn_operand **rev_ops, const unsigned int *size_lookup)
 {
+    const x86_insn_index *index = id_insn->index;
+    unsigned int num_operands = id_insn->insn.num_operands;
     const x86_insn_info *i;
-    int ni;
-    int found;
     int bypass;
 
     /* Check for matching # of operands */
-    found = 0;
-    for (ni=id_insn->num_info, i=id_insn->group; ni>0; ni--, i++) {
-        if (id_insn->insn.num_operands == i->num_operands) {
-            found = 1;
-            break;
-        }
-    }
-    if (!found) {
+    if (index->start[num_operands] == index->start[num_operands+1]) {
         yasm_error_set(YASM_ERROR_TYPE, N_("invalid number of operands"));
         return;
     }
@@ -1059,6 +1353,127 @@ x86_match_error(x86_id_insn *id_insn, yasm_insn_operand **ops,
     }
 }
 
+/* Determine the conditional jumps (as a bitmask of condition codes) that an
+ * instruction can macro-fuse with; 0 if it can't be the first half of a
+ * macro-fused pair.
+ */
+static unsigned int
+x86_fusible_jcc(const x86_id_insn *id_insn, yasm_insn_operand **ops)
+{
+    const yasm_insn_operand *dest;
+    unsigned int mask;
+    int rmw = 1;        /* does the instruction write its destination? */
+    int has_mem = 0, has_imm = 0;
+    unsigned int i;
+
+    if (id_insn->group == test_insn) {
+        mask = 0xFFFF;
+        rmw = 0;
+    } else if (id_insn->group == arith_insn) {
+        switch (id_insn->mod_data[0]) {
+            case 0x20:  /* and */
+                mask = 0xFFFF;
+                break;
+            case 0x38:  /* cmp */
+                rmw = 0;
+                /*@fallthrough@*/
+            case 0x00:  /* add */
+            case 0x28:  /* sub */
+                /* not with jo, jno, js, jns, jp, jnp */
+                mask = 0xF0FC;
+                break;
+            default:
+                return 0;
+        }
+    } else if (id_insn->group == incdec_insn) {
+        /* only with je, jne, jl, jge, jle, jg */
+        mask = 0xF030;
+    } else
+        return 0;
+
+    if (id_insn->insn.num_operands == 0)
+        return 0;
+
+    for (i=0; i<id_insn->insn.num_operands; i++) {
+        if (ops[i]->type == YASM_INSN__OPERAND_MEMORY)
+            has_mem = 1;
+        else if (ops[i]->type == YASM_INSN__OPERAND_IMM)
+            has_imm = 1;
+    }
+    dest = ops[id_insn->parser == X86_PARSER_GAS ?
+               id_insn->insn.num_operands-1 : 0];
+
+    /* Memory and immediate never fuse, nor does a memory destination that's
+     * written to.
+     */
+    if ((has_mem && has_imm) ||
+        (rmw && dest->type == YASM_INSN__OPERAND_MEMORY))
+        return 0;
+    return mask;
+}
+
+/* Insert padding ahead of branches (and instructions that macro-fuse with
+ * a following conditional jump) so they neither cross nor end on a 32-byte
+ * boundary.  The padding is an offset-setter bytecode, so it's relaxed
+ * along with the jump sizes in yasm_object_optimize().
+ */
+static void
+x86_id_insn_pad_branch(yasm_bytecode *bc, yasm_bytecode *prev_bc,
+                       const x86_insn_info *info, yasm_insn_operand **ops)
+{
+    x86_id_insn *id_insn = (x86_id_insn *)bc->contents;
+    yasm_bytecode *last_bc = bc;
+    /*@null@*/ yasm_bytecode *next_bc;
+    yasm_arch_x86 *arch_x86;
+    const unsigned char **fill;
+    unsigned int jcc_mask;
+    int split = 0;
+
+    if (!id_insn->jcc_erratum)
+        return;
+
+    if (id_insn->group != jmp_insn && id_insn->group != call_insn &&
+        id_insn->group != retnf_insn &&
+        (id_insn->insn.num_operands == 0 ||
+         insn_operands[info->operands_index+0].action != OPA_JmpRel)) {
+        /* Not a branch by itself; look for a macro-fused pair */
+        x86_id_insn *next_insn;
+
+        jcc_mask = x86_fusible_jcc(id_insn, ops);
+        if (jcc_mask == 0)
+            return;
+
+        /* Look past aligns (or orgs); they may turn out to be empty */
+        next_bc = STAILQ_NEXT(bc, link);
+        while (next_bc &&
+               next_bc->callback->special == YASM_BC_SPECIAL_OFFSET) {
+            split = 1;
+            next_bc = STAILQ_NEXT(next_bc, link);
+        }
+        if (!next_bc || next_bc->callback != &x86_id_insn_callback)
+            return;
+        next_insn = (x86_id_insn *)next_bc->contents;
+        if (next_insn->group != jcc_insn ||
+            !(jcc_mask & (1U << (next_insn->mod_data[0] & 0xF))))
+            return;
+
+        /* Pad the pair as a whole.  The jump doesn't need its own padding
+         * unless something in between can separate it from the compare.
+         */
+        if (!split)
+            next_insn->jcc_erratum = 0;
+        last_bc = next_bc;
+    }
+
+    arch_x86 = (yasm_arch_x86 *)yasm_section_get_object(bc->section)->arch;
+    fill = yasm_x86__get_fill(arch_x86, id_insn->mode_bits);
+    if (!fill)
+        return;
+
+    yasm_section_bcs_insert_after(bc->section, prev_bc,
+        yasm_x86__bc_create_branch_pad(last_bc, split, fill, bc->line));
+}
+
 static void
 x86_id_insn_finalize(yasm_bytecode *bc, yasm_bytecode *prev_bc)
 {
@@ -1134,7 +1549,7 @@ x86_id_insn_finalize(yasm_bytecode *bc, yasm_bytecode *prev_bc)
         }
     }
 
-    info = x86_find_match(id_insn, ops, rev_ops, size_lookup, 0);
+    info = x86_find_match_cached(bc, id_insn, ops, rev_ops, size_lookup);
 
     if (!info) {
         /* Didn't find a match */
@@ -1142,6 +1557,8 @@ x86_id_insn_finalize(yasm_bytecode *bc, yasm_bytecode *prev_bc)
         return;
     }
 
+    x86_id_insn_pad_branch(bc, prev_bc, info, ops);
+
     if (id_insn->insn.num_operands > 0) {
         switch (insn_operands[info->operands_index+0].action) {
             case OPA_JmpRel:
@@ -1170,6 +1587,9 @@ x86_id_insn_finalize(yasm_bytecode *bc, yasm_bytecode *prev_bc)
     im_sign = 0;
     insn->postop = X86_POSTOP_NONE;
     insn->rex = 0;
+    insn->prefix_align = id_insn->prefix_align;
+    insn->pad_prefix = 0;
+    insn->num_pad_prefix = 0;
 
     /* Move VEX/XOP data (stored in special prefix) to separate location to
      * allow overriding of special prefix by modifiers.
@@ -1676,6 +2096,9 @@ typedef struct insnprefix_parse_data {
     /* instruction parse group - NULL if prefix */
     /*@null@*/ const x86_insn_info *group;
 
+    /* instruction parse group match index - NULL if prefix */
+    /*@null@*/ const x86_insn_index *index;
+
     /* For instruction, number of elements in group.
      * For prefix, prefix type shifted right by 8.
      */
@@ -1708,83 +2131,83 @@ static const char *
 cpu_find_reverse(unsigned int cpu0, unsigned int cpu1, unsigned int cpu2)
 {
     static char cpuname[200];
-    wordptr cpu = BitVector_Create(128, TRUE);
+    x86_cpu_flags cpuset, *cpu = &cpuset;
 
+    X86_CPU_EMPTY(cpu);
     if (cpu0 != CPU_Any)
-        BitVector_Bit_On(cpu, cpu0);
+        X86_CPU_BIT_ON(cpu, cpu0);
     if (cpu1 != CPU_Any)
-        BitVector_Bit_On(cpu, cpu1);
+        X86_CPU_BIT_ON(cpu, cpu1);
     if (cpu2 != CPU_Any)
-        BitVector_Bit_On(cpu, cpu2);
+        X86_CPU_BIT_ON(cpu, cpu2);
 
     cpuname[0] = '\0';
 
-    if (BitVector_bit_test(cpu, CPU_Prot))
+    if (X86_CPU_BIT_TEST(cpu, CPU_Prot))
         strcat(cpuname, " Protected");
-    if (BitVector_bit_test(cpu, CPU_Undoc))
+    if (X86_CPU_BIT_TEST(cpu, CPU_Undoc))
         strcat(cpuname, " Undocumented");
-    if (BitVector_bit_test(cpu, CPU_Obs))
+    if (X86_CPU_BIT_TEST(cpu, CPU_Obs))
         strcat(cpuname, " Obsolete");
-    if (BitVector_bit_test(cpu, CPU_Priv))
+    if (X86_CPU_BIT_TEST(cpu, CPU_Priv))
         strcat(cpuname, " Privileged");
 
-    if (BitVector_bit_test(cpu, CPU_FPU))
+    if (X86_CPU_BIT_TEST(cpu, CPU_FPU))
         strcat(cpuname, " FPU");
-    if (BitVector_bit_test(cpu, CPU_MMX))
+    if (X86_CPU_BIT_TEST(cpu, CPU_MMX))
         strcat(cpuname, " MMX");
-    if (BitVector_bit_test(cpu, CPU_SSE))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SSE))
         strcat(cpuname, " SSE");
-    if (BitVector_bit_test(cpu, CPU_SSE2))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SSE2))
         strcat(cpuname, " SSE2");
-    if (BitVector_bit_test(cpu, CPU_SSE3))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SSE3))
         strcat(cpuname, " SSE3");
-    if (BitVector_bit_test(cpu, CPU_3DNow))
+    if (X86_CPU_BIT_TEST(cpu, CPU_3DNow))
         strcat(cpuname, " 3DNow");
-    if (BitVector_bit_test(cpu, CPU_Cyrix))
+    if (X86_CPU_BIT_TEST(cpu, CPU_Cyrix))
         strcat(cpuname, " Cyrix");
-    if (BitVector_bit_test(cpu, CPU_AMD))
+    if (X86_CPU_BIT_TEST(cpu, CPU_AMD))
         strcat(cpuname, " AMD");
-    if (BitVector_bit_test(cpu, CPU_SMM))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SMM))
         strcat(cpuname, " SMM");
-    if (BitVector_bit_test(cpu, CPU_SVM))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SVM))
         strcat(cpuname, " SVM");
-    if (BitVector_bit_test(cpu, CPU_PadLock))
+    if (X86_CPU_BIT_TEST(cpu, CPU_PadLock))
         strcat(cpuname, " PadLock");
-    if (BitVector_bit_test(cpu, CPU_EM64T))
+    if (X86_CPU_BIT_TEST(cpu, CPU_EM64T))
         strcat(cpuname, " EM64T");
-    if (BitVector_bit_test(cpu, CPU_SSSE3))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SSSE3))
         strcat(cpuname, " SSSE3");
-    if (BitVector_bit_test(cpu, CPU_SSE41))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SSE41))
         strcat(cpuname, " SSE4.1");
-    if (BitVector_bit_test(cpu, CPU_SSE42))
+    if (X86_CPU_BIT_TEST(cpu, CPU_SSE42))
         strcat(cpuname, " SSE4.2");
 
-    if (BitVector_bit_test(cpu, CPU_186))
+    if (X86_CPU_BIT_TEST(cpu, CPU_186))
         strcat(cpuname, " 186");
-    if (BitVector_bit_test(cpu, CPU_286))
+    if (X86_CPU_BIT_TEST(cpu, CPU_286))
         strcat(cpuname, " 286");
-    if (BitVector_bit_test(cpu, CPU_386))
+    if (X86_CPU_BIT_TEST(cpu, CPU_386))
         strcat(cpuname, " 386");
-    if (BitVector_bit_test(cpu, CPU_486))
+    if (X86_CPU_BIT_TEST(cpu, CPU_486))
         strcat(cpuname, " 486");
-    if (BitVector_bit_test(cpu, CPU_586))
+    if (X86_CPU_BIT_TEST(cpu, CPU_586))
         strcat(cpuname, " 586");
-    if (BitVector_bit_test(cpu, CPU_686))
+    if (X86_CPU_BIT_TEST(cpu, CPU_686))
         strcat(cpuname, " 686");
-    if (BitVector_bit_test(cpu, CPU_P3))
+    if (X86_CPU_BIT_TEST(cpu, CPU_P3))
         strcat(cpuname, " P3");
-    if (BitVector_bit_test(cpu, CPU_P4))
+    if (X86_CPU_BIT_TEST(cpu, CPU_P4))
         strcat(cpuname, " P4");
-    if (BitVector_bit_test(cpu, CPU_IA64))
+    if (X86_CPU_BIT_TEST(cpu, CPU_IA64))
         strcat(cpuname, " IA64");
-    if (BitVector_bit_test(cpu, CPU_K6))
+    if (X86_CPU_BIT_TEST(cpu, CPU_K6))
         strcat(cpuname, " K6");
-    if (BitVector_bit_test(cpu, CPU_Athlon))
+    if (X86_CPU_BIT_TEST(cpu, CPU_Athlon))
         strcat(cpuname, " Athlon");
-    if (BitVector_bit_test(cpu, CPU_Hammer))
+    if (X86_CPU_BIT_TEST(cpu, CPU_Hammer))
         strcat(cpuname, " Hammer");
 
-    BitVector_Destroy(cpu);
     return cpuname;
 }
 
@@ -1825,7 +2248,8 @@ yasm_x86__parse_check_insnprefix(yasm_arch *arch, const char *id,
 
     if (pdata->group) {
         x86_id_insn *id_insn;
-        wordptr cpu_enabled = arch_x86->cpu_enables[arch_x86->active_cpu];
+        const x86_cpu_flags *cpu_enabled =
+            &arch_x86->cpu_enables[arch_x86->active_cpu];
         unsigned int cpu0, cpu1, cpu2;
 
         if (arch_x86->mode_bits != 64 && (pdata->misc_flags & ONLY_64)) {
@@ -1839,7 +2263,8 @@ yasm_x86__parse_check_insnprefix(yasm_arch *arch, const char *id,
             id_insn = yasm_xmalloc(sizeof(x86_id_insn));
             yasm_insn_initialize(&id_insn->insn);
             id_insn->group = not64_insn;
-            id_insn->cpu_enabled = cpu_enabled;
+            id_insn->index = &not64_insn_index;
+            id_insn->cpu_enabled = *cpu_enabled;
             id_insn->mod_data[0] = 0;
             id_insn->mod_data[1] = 0;
             id_insn->mod_data[2] = 0;
@@ -1851,6 +2276,8 @@ yasm_x86__parse_check_insnprefix(yasm_arch *arch, const char *id,
 	
             id_insn->force_strict = arch_x86->force_strict != 0;
             id_insn->default_rel = arch_x86->default_rel != 0;
+            id_insn->jcc_erratum = arch_x86->jcc_erratum != 0;
+            id_insn->prefix_align = arch_x86->prefix_align != 0;
             *bc = yasm_bc_create_common(&x86_id_insn_callback, id_insn, line);
             return YASM_ARCH_INSN;
         }
@@ -1859,9 +2286,9 @@ yasm_x86__parse_check_insnprefix(yasm_arch *arch, const char *id,
         cpu1 = pdata->cpu1;
         cpu2 = pdata->cpu2;
 
-        if (!BitVector_bit_test(cpu_enabled, cpu0) ||
-            !BitVector_bit_test(cpu_enabled, cpu1) ||
-            !BitVector_bit_test(cpu_enabled, cpu2)) {
+        if (!X86_CPU_BIT_TEST(cpu_enabled, cpu0) ||
+            !X86_CPU_BIT_TEST(cpu_enabled, cpu1) ||
+            !X86_CPU_BIT_TEST(cpu_enabled, cpu2)) {
             yasm_warn_set(YASM_WARN_GENERAL,
                           N_("`%s' is an instruction in CPU%s"), id,
                           cpu_find_reverse(cpu0, cpu1, cpu2));
@@ -1871,7 +2298,8 @@ yasm_x86__parse_check_insnprefix(yasm_arch *arch, const char *id,
         id_insn = yasm_xmalloc(sizeof(x86_id_insn));
         yasm_insn_initialize(&id_insn->insn);
         id_insn->group = pdata->group;
-        id_insn->cpu_enabled = cpu_enabled;
+        id_insn->index = pdata->index;
+        id_insn->cpu_enabled = *cpu_enabled;
         id_insn->mod_data[0] = pdata->mod_data0;
         id_insn->mod_data[1] = pdata->mod_data1;
         id_insn->mod_data[2] = pdata->mod_data2;
@@ -1882,6 +2310,8 @@ yasm_x86__parse_check_insnprefix(yasm_arch *arch, const char *id,
         id_insn->parser = PARSER(arch_x86);
         id_insn->force_strict = arch_x86->force_strict != 0;
         id_insn->default_rel = arch_x86->default_rel != 0;
+        id_insn->jcc_erratum = arch_x86->jcc_erratum != 0;
+        id_insn->prefix_align = arch_x86->prefix_align != 0;
         *bc = yasm_bc_create_common(&x86_id_insn_callback, id_insn, line);
         return YASM_ARCH_INSN;
     } else {
@@ -1934,6 +2364,7 @@ yasm_x86__create_empty_insn(yasm_arch *arch, unsigned long line)
 
     yasm_insn_initialize(&id_insn->insn);
     id_insn->group = empty_insn;
+    id_insn->index = &empty_insn_index;
     id_insn->cpu_enabled = arch_x86->cpu_enables[arch_x86->active_cpu];
     id_insn->mod_data[0] = 0;
     id_insn->mod_data[1] = 0;
@@ -1945,6 +2376,8 @@ yasm_x86__create_empty_insn(yasm_arch *arch, unsigned long line)
     id_insn->parser = PARSER(arch_x86);
     id_insn->force_strict = arch_x86->force_strict != 0;
     id_insn->default_rel = arch_x86->default_rel != 0;
+    id_insn->jcc_erratum = 0;
+    id_insn->prefix_align = 0;
 
     return yasm_bc_create_common(&x86_id_insn_callback, id_insn, line);
 }
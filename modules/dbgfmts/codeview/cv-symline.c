@@ -207,7 +207,8 @@ static const yasm_bytecode_callback cv8_symhead_bc_callback = {
     cv8_symhead_bc_calc_len,
     yasm_bc_expand_common,
     cv8_symhead_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 static const yasm_bytecode_callback cv8_fileinfo_bc_callback = {
@@ -218,7 +219,8 @@ static const yasm_bytecode_callback cv8_fileinfo_bc_callback = {
     cv8_fileinfo_bc_calc_len,
     yasm_bc_expand_common,
     cv8_fileinfo_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 static const yasm_bytecode_callback cv8_lineinfo_bc_callback = {
@@ -229,7 +231,8 @@ static const yasm_bytecode_callback cv8_lineinfo_bc_callback = {
     cv8_lineinfo_bc_calc_len,
     yasm_bc_expand_common,
     cv8_lineinfo_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 static const yasm_bytecode_callback cv_sym_bc_callback = {
@@ -240,7 +243,8 @@ static const yasm_bytecode_callback cv_sym_bc_callback = {
     cv_sym_bc_calc_len,
     yasm_bc_expand_common,
     cv_sym_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 static cv8_symhead *cv8_add_symhead(yasm_section *sect, unsigned long type,
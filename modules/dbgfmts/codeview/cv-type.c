@@ -495,7 +495,8 @@ static const yasm_bytecode_callback cv_type_bc_callback = {
     cv_type_bc_calc_len,
     yasm_bc_expand_common,
     cv_type_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 static cv_type *cv_type_create(unsigned long indx);
@@ -58,7 +58,8 @@ static const yasm_bytecode_callback dwarf2_head_bc_callback = {
     dwarf2_head_bc_calc_len,
     yasm_bc_expand_common,
     dwarf2_head_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 /* Section data callback function prototypes */
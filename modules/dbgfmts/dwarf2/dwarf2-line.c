@@ -154,7 +154,8 @@ static const yasm_bytecode_callback dwarf2_spp_bc_callback = {
     dwarf2_spp_bc_calc_len,
     yasm_bc_expand_common,
     dwarf2_spp_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 static const yasm_bytecode_callback dwarf2_line_op_bc_callback = {
@@ -165,7 +166,8 @@ static const yasm_bytecode_callback dwarf2_line_op_bc_callback = {
     dwarf2_line_op_bc_calc_len,
     yasm_bc_expand_common,
     dwarf2_line_op_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 
@@ -235,7 +235,8 @@ static const yasm_bytecode_callback win32_sxdata_bc_callback = {
     win32_sxdata_bc_calc_len,
     yasm_bc_expand_common,
     win32_sxdata_bc_tobytes,
-    0
+    0,
+    NULL
 };
 
 yasm_objfmt_module yasm_coff_LTX_objfmt;
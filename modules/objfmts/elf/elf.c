@@ -274,21 +274,113 @@ elf_strtab_destroy(elf_strtab_head *strtab)
     yasm_xfree(strtab);
 }
 
+typedef struct elf_strtab_sort {
+    elf_strtab_entry *entry;
+    size_t len;
+    /*@dependent@*/ /*@null@*/ struct elf_strtab_sort *owner;
+} elf_strtab_sort;
+
+/* Orders strings by their reversed characters, descending, so that every
+ * string directly follows the longest string it is a suffix of.
+ */
+static int
+elf_strtab_sort_compare(const void *va, const void *vb)
+{
+    const elf_strtab_sort *a = va, *b = vb;
+    size_t i = a->len, j = b->len;
+
+    while (i > 0 && j > 0) {
+        unsigned char ca = (unsigned char)a->entry->str[--i];
+        unsigned char cb = (unsigned char)b->entry->str[--j];
+        if (ca != cb)
+            return ca < cb ? 1 : -1;
+    }
+    if (i == j)
+        return 0;
+    return i == 0 ? 1 : -1;
+}
+
+/* Entry indices are only read after this point, so the table is merged here:
+ * a string that is identical to or a suffix of another string is not written,
+ * its index instead points into the tail of the longer one.
+ */
 unsigned long
 elf_strtab_output_to_file(FILE *f, elf_strtab_head *strtab)
 {
-    unsigned long size = 0;
-    elf_strtab_entry *entry;
+    unsigned long size = 1;
+    elf_strtab_entry *entry, *first;
+    elf_strtab_sort *sorted;
+    size_t num = 0, i;
 
     if (strtab == NULL)
         yasm_internal_error("strtab is null");
+    if (STAILQ_EMPTY(strtab))
+        yasm_internal_error("strtab is missing initial dummy entry");
 
-    /* consider optimizing tables here */
+    /* The initial empty string stays at index 0 and is not merged. */
+    first = STAILQ_FIRST(strtab);
+    entry = STAILQ_NEXT(first, qlink);
+    while (entry) {
+        num++;
+        entry = STAILQ_NEXT(entry, qlink);
+    }
+
+    fputc('\0', f);
+    first->index = 0;
+    if (num == 0)
+        return size;
+
+    sorted = yasm_xmalloc(num*sizeof(elf_strtab_sort));
+    for (i = 0, entry = STAILQ_NEXT(first, qlink); entry;
+         i++, entry = STAILQ_NEXT(entry, qlink)) {
+        sorted[i].entry = entry;
+        sorted[i].len = strlen(entry->str);
+        sorted[i].owner = NULL;
+    }
+
+    /* The sort is stable, so of several equal strings the first one added
+     * is the one written.
+     */
+    yasm__mergesort(sorted, num, sizeof(elf_strtab_sort),
+                    elf_strtab_sort_compare);
+    for (i = 0; i < num; i++) {
+        elf_strtab_sort *prev = i > 0 ? sorted[i-1].owner : NULL;
+        if (sorted[i].len == 0)
+            ;   /* uses the initial empty string */
+        else if (prev && prev->len >= sorted[i].len &&
+                 strcmp(&prev->entry->str[prev->len - sorted[i].len],
+                        sorted[i].entry->str) == 0)
+            sorted[i].owner = prev;
+        else
+            sorted[i].owner = &sorted[i];
+        /* Keep each entry findable by its position in the list */
+        sorted[i].entry->index = (unsigned long)i;
+    }
+
+    /* Write the remaining strings in the order they were added */
     STAILQ_FOREACH(entry, strtab, qlink) {
-        size_t len = 1 + strlen(entry->str);
-        fwrite(entry->str, len, 1, f);
-        size += (unsigned long)len;
+        elf_strtab_sort *s;
+        if (entry == first)
+            continue;
+        s = &sorted[entry->index];
+        if (s->owner != s)
+            continue;
+        fwrite(entry->str, s->len + 1, 1, f);
+        s->entry->index = size;
+        size += (unsigned long)(s->len + 1);
+    }
+
+    /* Point merged strings into the tails of the strings they share */
+    for (i = 0; i < num; i++) {
+        elf_strtab_sort *owner = sorted[i].owner;
+        if (!owner)
+            sorted[i].entry->index = 0;
+        else if (owner != &sorted[i])
+            sorted[i].entry->index = owner->entry->index +
+                (unsigned long)(owner->len - sorted[i].len);
     }
+
+    yasm_xfree(sorted);
     return size;
 }
 
@@ -409,6 +501,13 @@ elf_symtab_append_entry(elf_symtab_head *symtab, elf_symtab_entry *entry)
     entry->in_table = 1;
 }
 
+/* Local symbols are placed directly after the STT_FILE entry, which the
+ * objfmt always appends right after the dummy entry.  The walk below thus
+ * stops at the second entry and insertion is constant time; it only scans
+ * the local partition for a symtab with no file entry.  Note this places
+ * later locals before earlier ones, and existing object output depends on
+ * that order, so don't "fix" it by appending at the end of the partition.
+ */
 void
 elf_symtab_insert_local_sym(elf_symtab_head *symtab, elf_symtab_entry *entry)
 {
@@ -0,0 +1,18 @@
+[bits 32]
+
+; foo and text are stored in the tails of longer names, and .text in the
+; tail of .rel.text.
+[global foo]
+[global get_foo]
+[extern text]
+[extern next_text]
+
+[section .text]
+get_foo:
+	mov eax, [foo]
+	call text
+	call next_text
+	ret
+
+[section .data]
+foo	dd 1
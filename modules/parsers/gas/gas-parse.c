@@ -48,7 +48,8 @@ static void cpp_line_marker(yasm_parser_gas *parser_gas);
 static void nasm_line_marker(yasm_parser_gas *parser_gas);
 static yasm_bytecode *parse_instr(yasm_parser_gas *parser_gas);
 static int parse_dirvals(yasm_parser_gas *parser_gas, yasm_valparamhead *vps);
-static int parse_datavals(yasm_parser_gas *parser_gas, yasm_datavalhead *dvs);
+static int parse_datavals(yasm_parser_gas *parser_gas, yasm_datavalhead *dvs,
+                          unsigned int size);
 static int parse_strvals(yasm_parser_gas *parser_gas, yasm_datavalhead *dvs);
 static yasm_effaddr *parse_memaddr(yasm_parser_gas *parser_gas);
 static yasm_insn_operand *parse_operand(yasm_parser_gas *parser_gas);
@@ -622,7 +623,7 @@ static yasm_bytecode *
 dir_data(yasm_parser_gas *parser_gas, unsigned int size)
 {
     yasm_datavalhead dvs;
-    if (!parse_datavals(parser_gas, &dvs))
+    if (!parse_datavals(parser_gas, &dvs, size))
         return NULL;
     return yasm_bc_create_data(&dvs, size, 0, p_object->arch, cur_line);
 }
@@ -631,7 +632,7 @@ static yasm_bytecode *
 dir_leb128(yasm_parser_gas *parser_gas, unsigned int sign)
 {
     yasm_datavalhead dvs;
-    if (!parse_datavals(parser_gas, &dvs))
+    if (!parse_datavals(parser_gas, &dvs, 0))
         return NULL;
     return yasm_bc_create_leb128(&dvs, (int)sign, cur_line);
 }
@@ -1057,11 +1058,14 @@ parse_dirvals(yasm_parser_gas *parser_gas, yasm_valparamhead *vps)
     return num;
 }
 
+/* Parse a list of data values of the given item size (0 if the values will
+ * not be converted directly, as for LEB128).
+ */
 static int
-parse_datavals(yasm_parser_gas *parser_gas, yasm_datavalhead *dvs)
+parse_datavals(yasm_parser_gas *parser_gas, yasm_datavalhead *dvs,
+               unsigned int size)
 {
     yasm_expr *e;
-    yasm_dataval *dv;
     int num = 0;
 
     yasm_dvs_initialize(dvs);
@@ -1073,8 +1077,7 @@ parse_datavals(yasm_parser_gas *parser_gas, yasm_datavalhead *dvs)
             yasm_dvs_initialize(dvs);
             return 0;
         }
-        dv = yasm_dv_create_expr(e);
-        yasm_dvs_append(dvs, dv);
+        yasm_dvs_append_expr(dvs, e, size, p_object->arch);
         num++;
         if (curtok != ',')
             break;
@@ -0,0 +1,100 @@
+# .rept / .endr
+.rept 3
+.byte 1
+.endr
+# .macro / .endm; the first definition of a name wins
+.macro pair a, b
+.byte \a, \b
+.endm
+.macro pair a, b
+.byte 0xee
+.endm
+pair 2, 3
+# Near-miss names are not the directive or macro they resemble
+.macro .setb v
+.byte \v + 0x10
+.endm
+.macro pai x
+.byte 0xee
+.endm
+.macro .byt v
+.byte 0xee
+.endm
+.setb 4
+.byte 5
+pair 6, 7
+# .set / .equ / .equiv
+.set s, 8
+.equ q, s + 1
+.equiv v, q + 1
+.byte s, q, v
+# .include
+.include "gaspp-directives.inc"
+.byte incval
+# Conditionals
+.if 1
+.byte 0x50
+.else
+.byte 0xee
+.endif
+.if 1
+.byte 0x51
+.elseif 1
+.byte 0xee
+.endif
+.ifeq 0
+.byte 0x52
+.endif
+.ifne 0
+.byte 0xee
+.else
+.byte 0x53
+.endif
+.ifge 0
+.byte 0x54
+.endif
+.ifgt 0
+.byte 0xee
+.endif
+.ifle 0
+.byte 0x55
+.endif
+.iflt 0
+.byte 0xee
+.endif
+.ifdef s
+.byte 0x56
+.endif
+.ifndef s
+.byte 0xee
+.endif
+.ifnotdef undefined_sym
+.byte 0x57
+.endif
+.ifb
+.byte 0x58
+.endif
+.ifnb x
+.byte 0x59
+.endif
+.ifc abc, abc
+.byte 0x5a
+.endif
+.ifnc abc, abd
+.byte 0x5b
+.endif
+.ifeqs "abc", "abc"
+.byte 0x5c
+.endif
+.ifnes "abc", "abc"
+.byte 0xee
+.endif
+# Directives inside a skipped block are not evaluated
+.if 0
+.set s, 0xee
+.rept 2
+.byte 0xee
+.endr
+.include "nonexistent.inc"
+.endif
+.byte s
@@ -0,0 +1,41 @@
+# Redefinition
+.set r, 1
+.byte r /* 0x1 */
+.set r, r+1
+.byte r /* 0x2 */
+.equ r, 7
+.byte r /* 0x7 */
+# A deferred define takes each name's value as of when that name is
+# first defined, not any later value.
+.set a, b + c
+.set c, 1
+.set c, 2
+.set b, 5
+.long a /* 0x6 */
+.set d, e * 2
+.set e, 3
+.set e, 4
+.byte d /* 0x6 */
+.byte e /* 0x4 */
+# Chained deferred defines, defined in order of use...
+.set f, g + 1
+.set g, h + 1
+.set h, 1
+.byte f /* 0x3 */
+.byte g /* 0x2 */
+# ...and out of order.
+.set k, j + 1
+.set i, 10
+.set j, i + 1
+.byte j /* 0xb */
+.byte k /* 0xc */
+.set m, n + o
+.set o, p * 2
+.set n, o + 1
+.set p, 3
+.byte m /* 0xd */
+.byte n /* 0x7 */
+# A name used twice in one deferred define
+.set q, s + s
+.set s, 4
+.byte q /* 0x8 */
@@ -0,0 +1,18 @@
+.set a, 1
+.set ab, 2
+.set abc, 3
+.set b, 4
+# Names next to operators and parentheses
+.byte a+b, a-b, (a)*b, -a+9 /* 0x5, 0xfd, 0x4, 0x8 */
+.byte ~a&0xff, a<<b, abc>>a, a|b, ab^a /* 0xfe, 0x10, 0x1, 0x5, 0x3 */
+.byte 2*a, 0x1a, b/ab /* 0x2, 0x1a, 0x2 */
+# Names that are prefixes of other names
+.byte abc, ab, a, abc+ab+a, ab-a /* 0x3, 0x2, 0x1, 0x6, 0x1 */
+.byte abd, ab_, a_b /* 0x21, 0x22, 0x23 */
+# Names inside strings and comments are left alone
+.ascii "a ab abc", "\"b\" a"
+.byte a # a comment naming ab and abc
+.byte b /* a comment naming ab and abc */
+abd = 0x21
+ab_ = 0x22
+a_b = 0x23
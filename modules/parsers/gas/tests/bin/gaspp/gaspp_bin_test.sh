@@ -0,0 +1,3 @@
+#! /bin/sh
+${srcdir}/out_test.sh gaspp_bin_test modules/parsers/gas/tests/bin/gaspp "gas preproc bin output" "-f bin -p gas -r gas -I${srcdir}/modules/parsers/gas/tests/bin/gaspp/" ""
+exit $?
@@ -211,14 +211,50 @@ expect_(yasm_parser_nasm *parser_nasm, int token)
 }
 #define expect(token) expect_(parser_nasm, token)
 
+/* Apply a source location reported out-of-band by the preprocessor.  When
+ * the input is being saved for a listing, the location change still takes
+ * a line of its own, just as the equivalent %line directive would.
+ */
+static void
+set_line_info(yasm_parser_nasm *parser_nasm, const yasm_preproc_lineinfo *info)
+{
+    char *marker;
+
+    if (!parser_nasm->save_input) {
+        yasm_linemap_set(parser_nasm->linemap, info->filename, 0, info->line,
+                         info->line_inc);
+        return;
+    }
+
+    yasm_linemap_set(parser_nasm->linemap, info->filename, 0,
+                     info->line - info->line_inc, info->line_inc);
+    marker = yasm_xmalloc(40+strlen(info->filename));
+    sprintf(marker, "%%line %lu+%lu %s", info->line, info->line_inc,
+            info->filename);
+    yasm_linemap_add_source(parser_nasm->linemap, NULL, marker);
+    yasm_xfree(marker);
+    yasm_linemap_goto_next(parser_nasm->linemap);
+}
+
+/* Lines are pulled from the preprocessor one at a time on this thread.  The
+ * preprocessor reports source locations through info rather than touching
+ * the linemap itself, but it still can't run ahead on a separate thread: its
+ * %if/%assign evaluation shares libyasm's non-reentrant expr/intnum scratch
+ * state and the global error/warning state with the parser.
+ */
 void
 nasm_parser_parse(yasm_parser_nasm *parser_nasm)
 {
     unsigned char *line;
+    yasm_preproc_lineinfo info;
+
     while ((line = (unsigned char *)
-            yasm_preproc_get_line(parser_nasm->preproc)) != NULL) {
+            yasm_preproc_get_line_ex(parser_nasm->preproc, &info)) != NULL) {
         yasm_bytecode *bc = NULL, *temp_bc;
 
+        if (info.changed)
+            set_line_info(parser_nasm, &info);
+
         parser_nasm->s.bot = line;
         parser_nasm->s.tok = line;
         parser_nasm->s.ptr = line;
@@ -652,10 +688,13 @@ error:
                         yasm_dvs_delete(&dvs);
                         return NULL;
                     }
-                } else
-                    dv = yasm_dv_create_expr(e);
+                } else {
+                    yasm_dvs_append_expr(&dvs, e, size, p_object->arch);
+                    goto dv_next;
+                }
 dv_done:
                 yasm_dvs_append(&dvs, dv);
+dv_next:
                 if (is_eol())
                     break;
                 if (!expect(',')) {
@@ -802,6 +841,21 @@ static yasm_insn_operand *
 parse_operand(yasm_parser_nasm *parser_nasm)
 {
     yasm_insn_operand *op;
+
+    /* Fast path for the most common immediate, a lone integer: skip the
+     * expression grammar (whose result would be the same).
+     */
+    if (curtok == INTNUM) {
+        get_peek_token(parser_nasm);
+        if (parser_nasm->peek_token == ','
+            || is_eol_tok(parser_nasm->peek_token)) {
+            op = yasm_operand_create_imm(
+                p_expr_new_ident(yasm_expr_int(INTNUM_val)));
+            get_next_token();
+            return op;
+        }
+    }
+
     switch (curtok) {
         case '[':
         {
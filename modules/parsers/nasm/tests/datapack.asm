@@ -0,0 +1,7 @@
+; constants packed with neighbouring strings and non-constant values
+db 1, "ab", 2, 3
+dw "a", 1, "bc", 2
+dd "abcd", 0x01020304, label, "xy", 5
+dq -1, label-$$, 2
+label:
+db 0x80, -1
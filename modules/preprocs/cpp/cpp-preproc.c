@@ -29,8 +29,35 @@
 #include <util.h>
 #include <libyasm.h>
 
-/* TODO: Use autoconf to get the limit on the command line length. */
-#define CMDLINE_SIZE 32770
+#if defined(HAVE_SPAWN_H) && defined(HAVE_POSIX_SPAWNP) && \
+    defined(HAVE_UNISTD_H)
+#define USE_POSIX_SPAWN
+#endif
+
+#ifdef USE_POSIX_SPAWN
+#include <errno.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+/* Not declared by <stdio.h> in strict ANSI mode. */
+FILE *fdopen(int fd, const char *mode);
+#else
+#if defined(HAVE_MKSTEMP) && defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+#ifdef HAVE_POPEN
+/* Not declared by <stdio.h> in strict ANSI mode. */
+FILE *popen(const char *command, const char *mode);
+int pclose(FILE *stream);
+#endif
+#endif
+
+#ifdef HAVE_MKSTEMP
+/* Not declared by <stdlib.h> in strict ANSI mode. */
+int mkstemp(char *tmpl);
+#endif
 
 #define BSIZE 512
 
@@ -62,7 +89,22 @@ typedef struct yasm_preproc_cpp {
     TAILQ_HEAD(cpp_arg_head, cpp_arg_entry) cpp_args;
 
     char *filename;
+
+    /*
+        Temporary file cpp writes dependency info into (via -MD -MF) while
+        preprocessing, so a single cpp run serves both get_line and
+        get_included_file.
+    */
+    char *deps_filename;
+
+    /*
+        f is the pipe from cpp until cpp has exited; after that it is either
+        NULL or a spool of the output that had not yet been read.
+    */
     FILE *f, *f_deps;
+#ifdef USE_POSIX_SPAWN
+    pid_t pid;
+#endif
     yasm_linemap *cur_lm;
     yasm_errwarns *errwarns;
 
@@ -72,80 +114,212 @@ typedef struct yasm_preproc_cpp {
 /* Flag values for yasm_preproc_cpp->flags. */
 #define CPP_HAS_BEEN_INVOKED        0x01
 #define CPP_HAS_GENERATED_DEPS      0x02
+#define CPP_HAS_EXITED              0x04
 
 /*******************************************************************************
     Internal functions and helpers.
 *******************************************************************************/
 
 /*
-    Append a string to the command line, ensuring that we don't overflow the
-    buffer.
-*/
-#define APPEND(s) do {                              \
-    size_t _len = strlen(s);                        \
-    if (p + _len >= limit)                          \
-        yasm__fatal(N_("command line too long!"));  \
-    strcpy(p, s);                                   \
-    p += _len;                                      \
-} while (0)
-
-/*
-    Put all the options together into a command line that can be used to invoke
-    cpp.
+    Put all the options together into a NULL-terminated argument vector that
+    can be used to invoke cpp.  CPP_PROG may contain several words (eg
+    "cc -E"), so it is split on spaces.  All strings in the vector are
+    allocated; free with cpp_destroy_argv().
 */
-static char *
-cpp_build_cmdline(yasm_preproc_cpp *pp, const char *extra)
+static char **
+cpp_build_argv(yasm_preproc_cpp *pp)
 {
-    char *cmdline, *p, *limit;
+    char **argv, *prog, *word;
+    size_t argc = 0, maxargs;
     cpp_arg_entry *arg;
 
-    /* Initialize command line. */
-    cmdline = p = yasm_xmalloc(strlen(CPP_PROG)+CMDLINE_SIZE);
-    limit = p + CMDLINE_SIZE;
-    strcpy(p, CPP_PROG);
-    p += strlen(CPP_PROG);
+    prog = yasm__xstrdup(CPP_PROG);
 
-    arg = TAILQ_FIRST(&pp->cpp_args);
+    /* Worst case: every other character of CPP_PROG starts a word. */
+    maxargs = strlen(prog)/2 + 1 + 6 + 1;
+    TAILQ_FOREACH(arg, &pp->cpp_args, entry)
+        maxargs += 2;
+    argv = yasm_xmalloc(maxargs*sizeof(char *));
 
-    /* Append arguments from the list. */
-    while ( arg ) {
-        APPEND(" ");
-        APPEND(arg->op);
-        APPEND(" ");
-        APPEND(arg->param);
+    for (word = strtok(prog, " "); word; word = strtok(NULL, " "))
+        argv[argc++] = yasm__xstrdup(word);
+    yasm_xfree(prog);
+    if (argc == 0)
+        yasm__fatal( N_("Failed to execute preprocessor") );
 
-        arg = TAILQ_NEXT(arg, entry);
+    /* Append arguments from the list. */
+    TAILQ_FOREACH(arg, &pp->cpp_args, entry) {
+        argv[argc++] = yasm__xstrdup(arg->op);
+        argv[argc++] = yasm__xstrdup(arg->param);
     }
 
-    /* Append extra arguments. */
-    if (extra) {
-        APPEND(" ");
-        APPEND(extra);
-    }
     /* Append final arguments. */
-    APPEND(" -x assembler-with-cpp ");
-    APPEND(pp->filename);
+    argv[argc++] = yasm__xstrdup("-MD");
+    argv[argc++] = yasm__xstrdup("-MF");
+    argv[argc++] = yasm__xstrdup(pp->deps_filename);
+    argv[argc++] = yasm__xstrdup("-x");
+    argv[argc++] = yasm__xstrdup("assembler-with-cpp");
+    argv[argc++] = yasm__xstrdup(pp->filename);
+    argv[argc] = NULL;
+
+    return argv;
+}
 
-    return cmdline;
+static void
+cpp_destroy_argv(char **argv)
+{
+    char **p;
+
+    for (p = argv; *p; p++)
+        yasm_xfree(*p);
+    yasm_xfree(argv);
+}
+
+/* Create the (empty) temporary file cpp writes dependency info into. */
+static void
+cpp_make_deps_file(yasm_preproc_cpp *pp)
+{
+#ifdef HAVE_MKSTEMP
+    const char *tmpdir = getenv("TMPDIR");
+    int fd;
+
+    if (!tmpdir || !*tmpdir)
+        tmpdir = "/tmp";
+    pp->deps_filename = yasm_xmalloc(strlen(tmpdir)+sizeof("/yasmcppXXXXXX"));
+    sprintf(pp->deps_filename, "%s/yasmcppXXXXXX", tmpdir);
+    fd = mkstemp(pp->deps_filename);
+    if (fd < 0)
+        yasm__fatal(N_("could not create temporary file `%s'"),
+                    pp->deps_filename);
+    close(fd);
+#else
+    pp->deps_filename = yasm__xstrdup(tmpnam(NULL));
+#endif
 }
 
-/* Invoke the c preprocessor. */
+/* Invoke the c preprocessor, with its output available in pp->f. */
+#if defined(USE_POSIX_SPAWN)
 static void
 cpp_invoke(yasm_preproc_cpp *pp)
 {
-    char *cmdline;
+    char **argv;
+    int fds[2];
+    posix_spawn_file_actions_t actions;
 
-    cmdline = cpp_build_cmdline(pp, NULL);
+    cpp_make_deps_file(pp);
+    argv = cpp_build_argv(pp);
+
+    if (pipe(fds) != 0)
+        yasm__fatal( N_("Failed to execute preprocessor") );
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    if (posix_spawnp(&pp->pid, argv[0], &actions, NULL, argv, environ) != 0)
+        yasm__fatal( N_("Failed to execute preprocessor") );
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    cpp_destroy_argv(argv);
+
+    pp->f = fdopen(fds[0], "r");
+    if (!pp->f)
+        yasm__fatal( N_("Failed to execute preprocessor") );
+}
+#elif defined(HAVE_POPEN)
+static void
+cpp_invoke(yasm_preproc_cpp *pp)
+{
+    char **argv, **arg, *cmdline, *p;
+    size_t len = 0;
+
+    cpp_make_deps_file(pp);
+    argv = cpp_build_argv(pp);
+
+    /* Join the arguments into a command line for the shell. */
+    for (arg = argv; *arg; arg++)
+        len += strlen(*arg) + 1;
+    cmdline = p = yasm_xmalloc(len);
+    for (arg = argv; *arg; arg++) {
+        if (arg != argv)
+            *p++ = ' ';
+        strcpy(p, *arg);
+        p += strlen(p);
+    }
+    cpp_destroy_argv(argv);
 
-#ifdef HAVE_POPEN
     pp->f = popen(cmdline, "r");
     if (!pp->f)
         yasm__fatal( N_("Failed to execute preprocessor") );
+
+    yasm_xfree(cmdline);
+}
 #else
+static void
+cpp_invoke(yasm_preproc_cpp *pp)
+{
     yasm__fatal( N_("Cannot execute preprocessor, no popen available") );
+}
 #endif
 
-    yasm_xfree(cmdline);
+/* Remove the dependency file and exit when cpp fails. */
+static void
+cpp_failed(yasm_preproc_cpp *pp)
+{
+    remove(pp->deps_filename);
+    yasm__fatal( N_("Preprocessor exited with failure") );
+}
+
+/* Close the pipe from cpp and wait for it to exit. */
+static void
+cpp_wait(yasm_preproc_cpp *pp)
+{
+    int status = 0;
+
+    pp->flags |= CPP_HAS_EXITED;
+#if defined(USE_POSIX_SPAWN)
+    fclose(pp->f);
+    pp->f = NULL;
+    while (waitpid(pp->pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            cpp_failed(pp);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        cpp_failed(pp);
+#elif defined(HAVE_POPEN)
+    status = pclose(pp->f);
+    pp->f = NULL;
+    if (status != 0)
+        cpp_failed(pp);
+#endif
+}
+
+/*
+    Let cpp run to completion so its dependency file is complete.  Any output
+    not yet read is spooled to a temporary file for later get_line calls.
+*/
+static void
+cpp_finish(yasm_preproc_cpp *pp)
+{
+    FILE *spool;
+    char buf[BSIZE];
+    size_t n;
+
+    if (pp->flags & CPP_HAS_EXITED)
+        return;
+
+    spool = tmpfile();
+    if (!spool)
+        yasm__fatal(N_("could not open temporary file"));
+    while ((n = fread(buf, 1, BSIZE, pp->f)) > 0)
+        fwrite(buf, 1, n, spool);
+
+    cpp_wait(pp);
+
+    rewind(spool);
+    pp->f = spool;
 }
 
 /* Free memory used by the list of arguments. */
@@ -161,25 +335,6 @@ cpp_destroy_args(yasm_preproc_cpp *pp)
     }
 }
 
-/* Invoke the c preprocessor to generate dependency info. */
-static void
-cpp_generate_deps(yasm_preproc_cpp *pp)
-{
-    char *cmdline;
-
-    cmdline = cpp_build_cmdline(pp, "-M");
-
-#ifdef HAVE_POPEN
-    pp->f_deps = popen(cmdline, "r");
-    if (!pp->f_deps)
-        yasm__fatal( N_("Failed to execute preprocessor") );
-#else
-    yasm__fatal( N_("Cannot execute preprocessor, no popen available") );
-#endif
-
-    yasm_xfree(cmdline);
-}
-
 /*******************************************************************************
     Interface functions.
 *******************************************************************************/
@@ -193,6 +348,7 @@ cpp_preproc_create(const char *in, yasm_symtab *symtab, yasm_linemap *lm,
 
     pp->preproc.module = &yasm_cpp_LTX_preproc;
     pp->f = pp->f_deps = NULL;
+    pp->deps_filename = NULL;
     pp->cur_lm = lm;
     pp->errwarns = errwarns;
     pp->flags = 0;
@@ -218,11 +374,15 @@ cpp_preproc_destroy(yasm_preproc *preproc)
 {
     yasm_preproc_cpp *pp = (yasm_preproc_cpp *)preproc;
 
-    if (pp->f) {
-#ifdef HAVE_POPEN
-        if (pclose(pp->f) != 0)
-            yasm__fatal( N_("Preprocessor exited with failure") );
-#endif
+    if ((pp->flags & CPP_HAS_BEEN_INVOKED) && !(pp->flags & CPP_HAS_EXITED))
+        cpp_wait(pp);
+    if (pp->f)
+        fclose(pp->f);
+    if (pp->f_deps)
+        fclose(pp->f_deps);
+    if (pp->deps_filename) {
+        remove(pp->deps_filename);
+        yasm_xfree(pp->deps_filename);
     }
 
     cpp_destroy_args(pp);
@@ -244,6 +404,9 @@ cpp_preproc_get_line(yasm_preproc *preproc)
         cpp_invoke(pp);
     }
 
+    if (!pp->f)
+        return NULL;
+
     /*
         Once the preprocessor has been run, we're just dealing with a normal
         file.
@@ -277,6 +440,8 @@ cpp_preproc_get_line(yasm_preproc *preproc)
     if (p == buf) {
         /* No data; must be at EOF */
         yasm_xfree(buf);
+        if (!(pp->flags & CPP_HAS_EXITED))
+            cpp_wait(pp);
         return NULL;
     }
 
@@ -298,10 +463,19 @@ cpp_preproc_get_included_file(yasm_preproc *preproc, char *buf,
     if (! (pp->flags & CPP_HAS_GENERATED_DEPS) ) {
         pp->flags |= CPP_HAS_GENERATED_DEPS;
 
-        cpp_generate_deps(pp);
+        if (! (pp->flags & CPP_HAS_BEEN_INVOKED) ) {
+            pp->flags |= CPP_HAS_BEEN_INVOKED;
+
+            cpp_invoke(pp);
+        }
+        cpp_finish(pp);
+
+        pp->f_deps = fopen(pp->deps_filename, "r");
+        if (!pp->f_deps)
+            yasm__fatal(N_("could not open file `%s'"), pp->deps_filename);
 
         /* Skip target name and first dependency. */
-        while (ch != ':')
+        while (ch != ':' && ch != EOF)
             ch = fgetc(pp->f_deps);
 
         fgetc(pp->f_deps);      /* Discard space after colon. */
@@ -398,5 +572,8 @@ yasm_preproc_module yasm_cpp_LTX_preproc = {
     cpp_preproc_predefine_macro,
     cpp_preproc_undefine_macro,
     cpp_preproc_define_builtin,
-    cpp_preproc_add_standard
+    cpp_preproc_add_standard,
+    NULL,
+    NULL,
+    NULL
 };
@@ -12,13 +12,12 @@
 #include <libyasm/coretype.h>
 #include <libyasm/intnum.h>
 #include <libyasm/expr.h>
-#include <libyasm/symrec.h>
 #include <ctype.h>
 
 #include "gas-eval.h"
 
-/* The assembler symbol table. */
-static yasm_symtab *symtab;
+/* Resolves identifiers to values. */
+static lookupfunc lookup;
 
 static scanner scan;    /* Address of scanner routine */
 static efunc error;     /* Address of error reporting routine */
@@ -385,11 +384,11 @@ static yasm_expr *expr6(void)
             tokval->t_integer = NULL;
             break;
           case TOKEN_ID:
-            if (symtab) {
-                yasm_symrec *sym =
-                    yasm_symtab_get(symtab, tokval->t_charptr);
-                if (sym) {
-                    e = yasm_expr_create_ident(yasm_expr_sym(sym), 0);
+            if (lookup) {
+                long value;
+                if (lookup(epriv, tokval->t_charptr, &value)) {
+                    e = yasm_expr_create_ident(yasm_expr_int(
+                        yasm_intnum_create_int(value)), 0);
                 } else {
                     error(epriv, ERR_NONFATAL,
                           "undefined symbol `%s' in preprocessor",
@@ -420,7 +419,7 @@ static yasm_expr *expr6(void)
 
 yasm_expr *evaluate (scanner sc, void *scprivate, struct tokenval *tv,
                      void *eprivate, int critical, efunc report_error,
-                     yasm_symtab *st)
+                     lookupfunc lf)
 {
     if (critical & CRITICAL) {
         critical &= ~CRITICAL;
@@ -433,7 +432,7 @@ yasm_expr *evaluate (scanner sc, void *scprivate, struct tokenval *tv,
     tokval = tv;
     error = report_error;
     epriv = eprivate;
-    symtab = st;
+    lookup = lf;
 
     if (tokval->t_type == TOKEN_INVALID)
         i = scan(scpriv, tokval);
@@ -67,6 +67,13 @@ struct tokenval {
 };
 typedef int (*scanner) (void *private_data, struct tokenval *tv);
 
+/*
+ * Identifiers are resolved through a lookup function, which stores
+ * the value of `name' in `*value' and returns non-zero if `name' is
+ * defined. It is passed the evaluator's error private data.
+ */
+typedef int (*lookupfunc) (void *private_data, const char *name, long *value);
+
 /*
  * Token types returned by the scanner, in addition to ordinary
  * ASCII character values, and zero for end-of-string.
@@ -108,13 +115,13 @@ enum {                                 /* token types, other than chars */
  */
 #define CRITICAL 0x100
 typedef yasm_expr *(*evalfunc) (scanner sc, void *scprivate, struct tokenval *tv,
-                                int critical, efunc error, yasm_symtab *symtab);
+                                int critical, efunc error, lookupfunc lookup);
 
 /*
  * The evaluator itself.
  */
 yasm_expr *evaluate (scanner sc, void *scprivate, struct tokenval *tv,
                      void *eprivate, int critical, efunc report_error,
-                     yasm_symtab *symtab);
+                     lookupfunc lookup);
 
 #endif
@@ -28,11 +28,11 @@
 #include <ctype.h>
 
 #include <libyasm.h>
+#include <libyasm/phash.h>
 #include "modules/preprocs/gas/gas-eval.h"
 
 #define FALSE 0
 #define TRUE  1
-#define BSIZE 512
 
 #ifndef MAXPATHLEN
 #define MAXPATHLEN 1024
@@ -56,15 +56,29 @@ typedef struct macro_entry {
     char **params;
     int num_lines;
     char **lines;
-    STAILQ_ENTRY(macro_entry) next;
 } macro_entry;
 
 typedef struct deferred_define {
     char *name;
     char *value;
-    SLIST_ENTRY(deferred_define) next;
+    int num_waiting;    /* references to names that are still undefined */
+    LIST_ENTRY(deferred_define) next;
 } deferred_define;
 
+/* One reference from a deferred define to a name that is undefined. */
+typedef struct define_wait {
+    deferred_define *def;
+    SLIST_ENTRY(define_wait) next;
+} define_wait;
+
+typedef struct define_entry {
+    char *name;
+    long value;
+    int defined;        /* cleared when a deferred .set takes the name */
+    /* Deferred defines waiting for this name to be defined. */
+    SLIST_HEAD(waiting_defines_head, define_wait) waiting;
+} define_entry;
+
 typedef struct expr_state {
     const char *string;
     char *symbol;
@@ -74,11 +88,11 @@ typedef struct expr_state {
 typedef struct yasm_preproc_gas {
     yasm_preproc_base preproc;   /* base structure */
 
-    FILE *in;
+    yasm_linereader in;
     char *in_filename;
 
-    yasm_symtab *defines;
-    SLIST_HEAD(deferred_defines_head, deferred_define) deferred_defines;
+    HAMT *defines;
+    LIST_HEAD(deferred_defines_head, deferred_define) deferred_defines;
 
     int depth;
     int skip_depth;
@@ -89,7 +103,7 @@ typedef struct yasm_preproc_gas {
 
     SLIST_HEAD(buffered_lines_head, buffered_line) buffered_lines;
     SLIST_HEAD(included_files_head, included_file) included_files;
-    STAILQ_HEAD(macros_head, macro_entry) macros;
+    HAMT *macros;
 
     int in_line_number;
     int next_line_number;
@@ -133,21 +147,6 @@ static void skip_whitespace2(char **line)
     }
 }
 
-static const char *matches(const char *line, const char *directive)
-{
-    skip_whitespace(&line);
-
-    if (*line == '.') {
-        line = starts_with(line + 1, directive);
-        if (line && (!*line || isspace(*line))) {
-            skip_whitespace(&line);
-            return line;
-        }
-    }
-
-    return NULL;
-}
-
 static int unquote(const char *arg, char *to, size_t to_size, char q, char expected, const char **remainder)
 {
     const char *quote;
@@ -192,46 +191,27 @@ static int unquote(const char *arg, char *to, size_t to_size, char q, char expec
 
 /* Line-reading. */
 
-static char *read_line_from_file(yasm_preproc_gas *pp, FILE *file)
+static void read_file(yasm_preproc_gas *pp, yasm_linereader *lr, FILE *file)
 {
-    int bufsize = BSIZE;
-    char *buf;
-    char *p;
-
-    buf = yasm_xmalloc((size_t)bufsize);
-
-    /* Loop to ensure entire line is read (don't want to limit line length). */
-    p = buf;
-    for (;;) {
-        if (!fgets(p, bufsize - (p - buf), file)) {
-            if (ferror(file)) {
-                yasm_error_set(YASM_ERROR_IO, N_("error when reading from file"));
-                yasm_errwarn_propagate(pp->errwarns, pp->current_line_number);
-            }
-            break;
-        }
-        p += strlen(p);
-        if (p > buf && p[-1] == '\n') {
-            break;
-        }
-        if ((p - buf) + 1 >= bufsize) {
-            /* Increase size of buffer */
-            char *oldbuf = buf;
-            bufsize *= 2;
-            buf = yasm_xrealloc(buf, (size_t) bufsize);
-            p = buf + (p - oldbuf);
-        }
+    yasm_linereader_initialize(lr, file);
+    if (ferror(file)) {
+        yasm_error_set(YASM_ERROR_IO, N_("error when reading from file"));
+        yasm_errwarn_propagate(pp->errwarns, pp->current_line_number);
     }
+}
 
-    if (p == buf) {
-        /* No data; must be at EOF */
-        yasm_xfree(buf);
+static char *read_line_from_file(yasm_linereader *lr)
+{
+    size_t len;
+    unsigned long nlines;
+    char *line = yasm_linereader_next(lr, 0, &len, &nlines);
+
+    if (!line) {
         return NULL;
     }
 
     /* Strip the line ending */
-    buf[strcspn(buf, "\r\n")] = '\0';
-    return buf;
+    return yasm__xstrndup(line, strcspn(line, "\r"));
 }
 
 static char *read_line(yasm_preproc_gas *pp)
@@ -261,7 +241,7 @@ static char *read_line(yasm_preproc_gas *pp)
         return line;
     }
 
-    line = read_line_from_file(pp, pp->in);
+    line = read_line_from_file(&pp->in);
     if (line) {
         pp->in_line_number++;
         pp->next_line_number = pp->in_line_number;
@@ -333,6 +313,50 @@ static void gas_scan_cleanup(yasm_preproc_gas *pp, struct tokenval *tokval)
     }
 }
 
+/* It should be tested whether GAS supports all of these or if there are missing ones. */
+static const struct {
+    const char *op;
+    int token;
+} ops[] = {
+    { "<<", TOKEN_SHL },
+    { ">>", TOKEN_SHR },
+    { "//", TOKEN_SDIV },
+    { "%%", TOKEN_SMOD },
+    { "==", TOKEN_EQ },
+    { "!=", TOKEN_NE },
+    { "<>", TOKEN_NE },
+    { "<=", TOKEN_LE },
+    { ">=", TOKEN_GE },
+    { "&&", TOKEN_DBL_AND },
+    { "^^", TOKEN_DBL_XOR },
+    { "||", TOKEN_DBL_OR }
+};
+
+/* Returns the token for a two-character operator at str, or TOKEN_INVALID. */
+static int find_op(const char *str)
+{
+    unsigned i;
+
+    if (str[0] && str[1]) {
+        for (i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+            if (str[0] == ops[i].op[0] && str[1] == ops[i].op[1]) {
+                return ops[i].token;
+            }
+        }
+    }
+    return TOKEN_INVALID;
+}
+
+static int is_symbol_start(char c)
+{
+    return isalpha(c) || c == '_' || c == '.' || c == '%';
+}
+
+static int is_symbol_char(char c)
+{
+    return isalnum(c) || c == '$' || c == '_';
+}
+
 static int gas_scan(void *preproc, struct tokenval *tokval)
 {
     yasm_preproc_gas *pp = (yasm_preproc_gas *) preproc;
@@ -388,36 +412,7 @@ static int gas_scan(void *preproc, struct tokenval *tokval)
     tokval->t_type = TOKEN_INVALID;
     str = get_str(pp);
 
-    {
-        /* It should be tested whether GAS supports all of these or if there are missing ones. */
-        unsigned i;
-        struct {
-            const char *op;
-            int token;
-        } ops[] = {
-            { "<<", TOKEN_SHL },
-            { ">>", TOKEN_SHR },
-            { "//", TOKEN_SDIV },
-            { "%%", TOKEN_SMOD },
-            { "==", TOKEN_EQ },
-            { "!=", TOKEN_NE },
-            { "<>", TOKEN_NE },
-            { "<>", TOKEN_NE },
-            { "<=", TOKEN_LE },
-            { ">=", TOKEN_GE },
-            { "&&", TOKEN_DBL_AND },
-            { "^^", TOKEN_DBL_XOR },
-            { "||", TOKEN_DBL_OR }
-        };
-       if (strlen(str) > 1) {
-            for (i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
-                if (!strncmp(str, ops[i].op, 2)) {
-                    tokval->t_type = ops[i].token;
-                    break;
-                }
-            }
-       }
-    }
+    tokval->t_type = find_op(str);
 
     if (tokval->t_type != TOKEN_INVALID) {
         next_char(pp);
@@ -429,11 +424,11 @@ static int gas_scan(void *preproc, struct tokenval *tokval)
         tokval->t_type = c;
 
         /* Is it a symbol? If so we need to make it a TOKEN_ID. */
-        if (isalpha(c) || c == '_' || c == '.' || c == '%') {
+        if (is_symbol_start(c)) {
             int symbol_length = 1;
 
             c = get_char(pp);
-            while (isalnum(c) || c == '$' || c == '_') {
+            while (is_symbol_char(c)) {
                 symbol_length++;
                 next_char(pp);
                 c = get_char(pp);
@@ -466,6 +461,52 @@ static void gas_err(void *private_data, int severity, const char *fmt, ...)
     pp->fatal_error = 1;
 }
 
+/* Define table. */
+
+static void free_define(void *data)
+{
+    define_entry *define = data;
+    while (!SLIST_EMPTY(&define->waiting)) {
+        define_wait *wait = SLIST_FIRST(&define->waiting);
+        SLIST_REMOVE_HEAD(&define->waiting, next);
+        yasm_xfree(wait);
+    }
+    yasm_xfree(define->name);
+    yasm_xfree(define);
+}
+
+static define_entry *get_define(yasm_preproc_gas *pp, const char *name)
+{
+    define_entry *define = HAMT_search(pp->defines, name);
+    return (define && define->defined) ? define : NULL;
+}
+
+static define_entry *get_define_entry(yasm_preproc_gas *pp, const char *name)
+{
+    define_entry *define = HAMT_search(pp->defines, name);
+    int replace = 0;
+
+    if (!define) {
+        define = yasm_xmalloc(sizeof(define_entry));
+        define->name = yasm__xstrdup(name);
+        define->value = 0;
+        define->defined = FALSE;
+        SLIST_INIT(&define->waiting);
+        HAMT_insert(pp->defines, define->name, define, &replace, free_define);
+    }
+    return define;
+}
+
+static int lookup_define(void *private_data, const char *name, long *value)
+{
+    define_entry *define = get_define((yasm_preproc_gas *) private_data, name);
+    if (!define) {
+        return 0;
+    }
+    *value = define->value;
+    return 1;
+}
+
 static long eval_expr(yasm_preproc_gas *pp, const char *arg1)
 {
     struct tokenval tv;
@@ -480,7 +521,7 @@ static long eval_expr(yasm_preproc_gas *pp, const char *arg1)
 
     prev_state = pp->expr;
     gas_scan_init(pp, &tv, arg1);
-    expr = evaluate(gas_scan, pp, &tv, pp, CRITICAL, gas_err, pp->defines);
+    expr = evaluate(gas_scan, pp, &tv, pp, CRITICAL, gas_err, lookup_define);
     intn = yasm_expr_get_intnum(&expr, 0);
     value = yasm_intnum_get_int(intn);
     yasm_expr_destroy(expr);
@@ -615,8 +656,7 @@ static int eval_ifeqs(yasm_preproc_gas *pp, int negate, const char *args)
 
 static int eval_ifdef(yasm_preproc_gas *pp, int negate, const char *name)
 {
-    yasm_symrec *rec = yasm_symtab_get(pp->defines, name);
-    int result = (rec != NULL);
+    int result = (get_define(pp, name) != NULL);
     return handle_if(pp, (negate ? !result : result));
 }
 
@@ -641,6 +681,7 @@ static int eval_include(yasm_preproc_gas *pp, int unused, const char *arg1)
     char *line;
     int num_lines;
     FILE *file;
+    yasm_linereader lr;
     buffered_line *prev_bline;
     included_file *inc_file;
 
@@ -662,9 +703,12 @@ static int eval_include(yasm_preproc_gas *pp, int unused, const char *arg1)
         return 0;
     }
 
+    read_file(pp, &lr, file);
+    fclose(file);
+
     num_lines = 0;
     prev_bline = NULL;
-    line = read_line_from_file(pp, file);
+    line = read_line_from_file(&lr);
     while (line) {
         buffered_line *bline = yasm_xmalloc(sizeof(buffered_line));
         bline->line = line;
@@ -675,9 +719,10 @@ static int eval_include(yasm_preproc_gas *pp, int unused, const char *arg1)
             SLIST_INSERT_HEAD(&pp->buffered_lines, bline, next);
         }
         prev_bline = bline;
-        line = read_line_from_file(pp, file);
+        line = read_line_from_file(&lr);
         num_lines++;
     }
+    yasm_linereader_delete(&lr);
 
     inc_file = yasm_xmalloc(sizeof(included_file));
     inc_file->filename = yasm__xstrdup(filename);
@@ -701,70 +746,96 @@ static int try_eval_expr(yasm_preproc_gas *pp, const char *value, long *result)
 
 static int remove_define(yasm_preproc_gas *pp, const char *name, int allow_redefine)
 {
-    yasm_symrec *rec = yasm_symtab_get(pp->defines, name);
-    if (rec) {
-        const yasm_symtab_iter *entry;
-        yasm_symtab *new_defines;
-
+    define_entry *define = get_define(pp, name);
+    if (define) {
         if (!allow_redefine) {
             yasm_error_set(YASM_ERROR_SYNTAX, N_("symbol \"%s\" is already defined"), name);
             yasm_errwarn_propagate(pp->errwarns, pp->current_line_number);
             return 0;
         }
+        define->defined = FALSE;
+    }
+    return 1;
+}
 
-        new_defines = yasm_symtab_create();
+/* Queue a deferred define on every name in its value that is still
+ * undefined.  Each of those names is substituted into the value when it is
+ * first defined, so the define sees the value it had at that point and not
+ * any later one.  Once no names are left, the define is evaluated.
+ */
+static void wait_for_define(yasm_preproc_gas *pp, deferred_define *def)
+{
+    struct tokenval tokval;
+    expr_state prev_state = pp->expr;
 
-        for (entry = yasm_symtab_first(pp->defines); entry; entry = yasm_symtab_next(entry)) {
-            yasm_symrec *entry_rec = yasm_symtab_iter_value(entry);
-            const char *rec_name = yasm_symrec_get_name(entry_rec);
-            if (strcmp(rec_name, name)) {
-                yasm_intnum *num = yasm_intnum_create_int(eval_expr(pp, rec_name));
-                yasm_expr *expr = yasm_expr_create_ident(yasm_expr_int(num), 0);
-                yasm_symtab_define_equ(new_defines, rec_name, expr, 0);
-            } 
+    def->num_waiting = 0;
+    gas_scan_init(pp, &tokval, def->value);
+    while (gas_scan(pp, &tokval) != TOKEN_EOS) {
+        if (tokval.t_type == TOKEN_ID && !get_define(pp, tokval.t_charptr)) {
+            define_entry *define = get_define_entry(pp, tokval.t_charptr);
+            define_wait *wait = yasm_xmalloc(sizeof(define_wait));
+            wait->def = def;
+            SLIST_INSERT_HEAD(&define->waiting, wait, next);
+            def->num_waiting++;
         }
+    }
+    gas_scan_cleanup(pp, &tokval);
+    pp->expr = prev_state;
+}
 
-        yasm_symtab_destroy(pp->defines);
-        pp->defines = new_defines;
+static void take_waiting(define_entry *define, struct waiting_defines_head *pending)
+{
+    while (!SLIST_EMPTY(&define->waiting)) {
+        define_wait *wait = SLIST_FIRST(&define->waiting);
+        SLIST_REMOVE_HEAD(&define->waiting, next);
+        SLIST_INSERT_HEAD(pending, wait, next);
     }
-    return (rec != NULL);
 }
 
-static void add_define(yasm_preproc_gas *pp, const char *name, long value, int allow_redefine, int substitute)
+static void add_define(yasm_preproc_gas *pp, const char *name, long value, int allow_redefine)
 {
-    deferred_define *def, *prev_def, *temp_def;
-    yasm_intnum *num;
-    yasm_expr *expr;
+    struct waiting_defines_head pending;
+    define_entry *define;
 
-    remove_define(pp, name, allow_redefine);
-
-    /* Add the new define. */
-    num = yasm_intnum_create_int(value);
-    expr = yasm_expr_create_ident(yasm_expr_int(num), 0);
-    yasm_symtab_define_equ(pp->defines, name, expr, 0);
-
-    /* Perform substitution on any deferred defines. */
-    if (substitute) {
-        prev_def = NULL;
-        temp_def = NULL;
-        SLIST_FOREACH_SAFE(def, &pp->deferred_defines, next, temp_def) {
-            if (substitute_values(pp, &def->value)) {
-                /* Value was updated - check if it can be added to the symtab. */
-                if (try_eval_expr(pp, def->value, &value)) {
-                    add_define(pp, def->name, value, FALSE, FALSE);
-                    if (prev_def) {
-                        SLIST_NEXT(prev_def, next) = SLIST_NEXT(def, next);
-                    } else {
-                        SLIST_FIRST(&pp->deferred_defines) = SLIST_NEXT(def, next);
-                    }
-                    yasm_xfree(def->name);
-                    yasm_xfree(def->value);
-                    yasm_xfree(def);
-                    continue;
-                }
-            }
-            prev_def = def;
+    if (!remove_define(pp, name, allow_redefine)) {
+        return;
+    }
+
+    /* Add the new define, reusing its entry if it was defined before. */
+    define = get_define_entry(pp, name);
+    define->value = value;
+    define->defined = TRUE;
+
+    /* Substitute the name into the deferred defines that were waiting for
+     * it, and evaluate those with no undefined names left.  Defining them
+     * in turn feeds the defines waiting on them.
+     */
+    SLIST_INIT(&pending);
+    take_waiting(define, &pending);
+    while (!SLIST_EMPTY(&pending)) {
+        define_wait *wait = SLIST_FIRST(&pending);
+        deferred_define *def = wait->def;
+        SLIST_REMOVE_HEAD(&pending, next);
+        yasm_xfree(wait);
+
+        substitute_values(pp, &def->value);
+        if (--def->num_waiting > 0 || !try_eval_expr(pp, def->value, &value)) {
+            continue;
         }
+
+        define = get_define_entry(pp, def->name);
+        if (define->defined) {
+            yasm_error_set(YASM_ERROR_SYNTAX, N_("symbol \"%s\" is already defined"), def->name);
+            yasm_errwarn_propagate(pp->errwarns, pp->current_line_number);
+        } else {
+            define->value = value;
+            define->defined = TRUE;
+            take_waiting(define, &pending);
+        }
+        LIST_REMOVE(def, next);
+        yasm_xfree(def->name);
+        yasm_xfree(def->value);
+        yasm_xfree(def);
     }
 }
 
@@ -780,14 +851,37 @@ static int eval_set(yasm_preproc_gas *pp, int allow_redefine, const char *name,
             def->name = yasm__xstrdup(name);
             def->value = yasm__xstrdup(value);
             substitute_values(pp, &def->value);
-            SLIST_INSERT_HEAD(&pp->deferred_defines, def, next);
+            LIST_INSERT_HEAD(&pp->deferred_defines, def, next);
+            wait_for_define(pp, def);
         } else {
-            add_define(pp, name, result, allow_redefine, TRUE);
+            add_define(pp, name, result, allow_redefine);
         }
     }
     return 1;
 }
 
+static void free_macro(void *data)
+{
+    macro_entry *macro = data;
+    int i;
+
+    yasm_xfree(macro->name);
+    for (i = 0; i < macro->num_params; i++)
+        yasm_xfree(macro->params[i]);
+    yasm_xfree(macro->params);
+    for (i = 0; i < macro->num_lines; i++)
+        yasm_xfree(macro->lines[i]);
+    yasm_xfree(macro->lines);
+    yasm_xfree(macro);
+}
+
+/* The first definition of a name is the one that is used. */
+static void add_macro(yasm_preproc_gas *pp, macro_entry *macro)
+{
+    int replace = 0;
+    HAMT_insert(pp->macros, macro->name, macro, &replace, free_macro);
+}
+
 static int eval_macro(yasm_preproc_gas *pp, int unused, char *args)
 {
     char *end;
@@ -823,8 +917,6 @@ static int eval_macro(yasm_preproc_gas *pp, int unused, char *args)
         }
     }
 
-    STAILQ_INSERT_TAIL(&pp->macros, macro, next);
-
     line = read_line(pp);
     while (line) {
         char *line2 = line;
@@ -832,6 +924,7 @@ static int eval_macro(yasm_preproc_gas *pp, int unused, char *args)
         if (starts_with(line2, ".macro")) {
             nesting++;
         } else if (starts_with(line2, ".endm") && --nesting == 0) {
+            add_macro(pp, macro);
             return 1;
         }
         macro->num_lines++;
@@ -840,6 +933,7 @@ static int eval_macro(yasm_preproc_gas *pp, int unused, char *args)
         line = read_line(pp);
     }
 
+    add_macro(pp, macro);
     yasm_error_set(YASM_ERROR_SYNTAX, N_("unexpected EOF in \".macro\" block"));
     yasm_errwarn_propagate(pp->errwarns, yasm_linemap_get_current(pp->cur_lm));
     return 0;
@@ -1042,6 +1136,15 @@ typedef int (*pp_fn2_t)(yasm_preproc_gas *pp, int param, const char *arg1, const
 
 #define FN(f) ((pp_fn0_t) &(f))
 
+struct gas_directive {
+    const char *name;
+    int nargs;
+    pp_fn0_t fn;
+    int param;
+};
+
+#include "gas-directives.c"
+
 static void kill_comments(yasm_preproc_gas *pp, char *line)
 {
     int next = 2;
@@ -1077,88 +1180,112 @@ static void kill_comments(yasm_preproc_gas *pp, char *line)
    }
 }
 
+/* Replace each defined symbol in the line with its value, scanning it
+ * the way gas_scan() would. The new line is built in a single buffer,
+ * allocated only once the first define is found.
+ */
 static int substitute_values(yasm_preproc_gas *pp, char **line_ptr)
 {
-    int changed = 0;
     char *line = *line_ptr;
-    int line_length = strlen(line);
-    struct tokenval tokval;
-    expr_state prev_state = pp->expr;
-
-    gas_scan_init(pp, &tokval, line);
-    while (gas_scan(pp, &tokval) != TOKEN_EOS) {
-        if (tokval.t_type == TOKEN_ID) {
-            yasm_symrec *rec = yasm_symtab_get(pp->defines, tokval.t_charptr);
-            if (rec) {
-                int cursor = pp->expr.string_cursor;
-                int len = strlen(tokval.t_charptr);
-                char value[64];
-                int value_length = sprintf(value, "%ld", eval_expr(pp, tokval.t_charptr));
-                int delta = value_length - len;
-
-                line_length += delta;
-                if (delta > 0) {
-                    line = yasm_xrealloc(line, line_length + 1);
+    char *p = line, *copied = line;
+    char *out = NULL;
+    size_t line_len = 0, out_len = 0, out_size = 0;
+
+    while (*p) {
+        char *sym;
+        define_entry *define;
+        char value[64], save;
+        size_t len, rest, value_length;
+
+        if (isspace(*p)) {
+            p++;
+            continue;
+        }
+        if (*p == '"') {
+            /* String constants, as in gas_scan(); names in them are text. */
+            p++;
+            while (*p && *p != '"') {
+                if (*p == '\\' && p[1]) {
+                    p++;
+                }
+                p++;
+            }
+            if (*p) {
+                p++;
+            }
+            continue;
+        }
+        if (isdigit(*p)) {
+            /* Numbers, as in gas_scan(); a trailing symbol is separate. */
+            int is_zero = (*p == '0');
+            p++;
+            if (is_zero && *p == 'x') {
+                p++;
+                while (ishex(*p)) {
+                    p++;
+                }
+            } else {
+                while (isdigit(*p)) {
+                    p++;
                 }
-                memmove(line + cursor - len + value_length, line + cursor, strlen(line + cursor) + 1);
-                memcpy(line + cursor - len, value, value_length);
-                pp->expr.string = line;
-                pp->expr.string_cursor = cursor + delta;
-                changed = 1;
             }
-            yasm_xfree(pp->expr.symbol);
-            pp->expr.symbol = NULL;
+            continue;
         }
+        if (find_op(p) != TOKEN_INVALID) {
+            p += 2;
+            continue;
+        }
+        if (!is_symbol_start(*p++)) {
+            continue;
+        }
+
+        sym = p - 1;
+        while (is_symbol_char(*p)) {
+            p++;
+        }
+        save = *p;
+        *p = '\0';
+        define = get_define(pp, sym);
+        *p = save;
+        if (!define) {
+            continue;
+        }
+
+        if (!out) {
+            line_len = strlen(line);
+        }
+        value_length = (size_t) sprintf(value, "%ld", define->value);
+        len = (size_t) (sym - copied);
+        rest = line_len - (size_t) (p - line);
+        if (out_len + len + value_length + rest + 1 > out_size) {
+            out_size = (out_len + len + value_length + rest) * 2 + 1;
+            out = yasm_xrealloc(out, out_size);
+        }
+        memcpy(out + out_len, copied, len);
+        out_len += len;
+        memcpy(out + out_len, value, value_length);
+        out_len += value_length;
+        copied = p;
     }
-    gas_scan_cleanup(pp, &tokval);
-    pp->expr = prev_state;
 
-    if (changed) {
-        *line_ptr = line;
+    if (!out) {
+        return 0;
     }
 
-    return changed;
+    memcpy(out + out_len, copied, line_len - (size_t) (copied - line) + 1);
+    yasm_xfree(line);
+    *line_ptr = out;
+    return 1;
 }
 
 static int process_line(yasm_preproc_gas *pp, char **line_ptr)
 {
+    const struct gas_directive *directive = NULL;
     macro_entry *macro;
-    size_t i;
     char *line = *line_ptr;
-    struct {
-        const char *name;
-        int nargs;
-        pp_fn0_t fn;
-        int param;
-    } directives[] = {
-        {"else", 0, FN(eval_else), 0},
-        {"elseif", 1, FN(eval_elseif), 0},
-        {"endif", 0, FN(eval_endif), 0},
-        {"if", 1, FN(eval_if), 0},
-        {"ifb", 1, FN(eval_ifb), 0},
-        {"ifc", 1, FN(eval_ifc), 0},
-        {"ifdef", 1, FN(eval_ifdef), 0},
-        {"ifeq", 1, FN(eval_if), 1},
-        {"ifeqs", 1, FN(eval_ifeqs), 0},
-        {"ifge", 1, FN(eval_ifge), 0},
-        {"ifgt", 1, FN(eval_ifgt), 0},
-        {"ifle", 1, FN(eval_ifgt), 1},
-        {"iflt", 1, FN(eval_ifge), 1},
-        {"ifnb", 1, FN(eval_ifb), 1},
-        {"ifnc", 1, FN(eval_ifc), 1},
-        {"ifndef", 1, FN(eval_ifdef), 1},
-        {"ifnotdef", 1, FN(eval_ifdef), 1},
-        {"ifne", 1, FN(eval_if), 0},
-        {"ifnes", 1, FN(eval_ifeqs), 1},
-        {"include", 1, FN(eval_include), 0},
-        {"set", 2, FN(eval_set), 1},
-        {"equ", 2, FN(eval_set), 1},
-        {"equiv", 2, FN(eval_set), 0},
-        {"macro", 1, FN(eval_macro), 0},
-        {"endm", 0, FN(eval_endm), 0},
-        {"rept", 1, FN(eval_rept), 0},
-        {"endr", 1, FN(eval_endr), 0},
-    };
+    char *end;
+    const char *remainder;
+    char save;
 
     kill_comments(pp, line);
     skip_whitespace2(&line);
@@ -1166,54 +1293,60 @@ static int process_line(yasm_preproc_gas *pp, char **line_ptr)
         return FALSE;
     }
 
-    /* See if this is a macro call. */
-    STAILQ_FOREACH(macro, &pp->macros, next) {
-        const char *remainder = starts_with(line, macro->name);
-        if (remainder && (!*remainder || isspace(*remainder))) {
-            skip_whitespace2(&line);
-            expand_macro(pp, macro, remainder);
-            return FALSE;
-        }
+    /* Look up the first word as a macro call, then as a directive. */
+    end = line;
+    while (*end && !isspace(*end)) {
+        end++;
     }
+    save = *end;
+    *end = '\0';
+    macro = HAMT_search(pp->macros, line);
+    if (!macro && line[0] == '.') {
+        directive = gas_directive_find(line + 1, (size_t) (end - line - 1));
+    }
+    *end = save;
+    remainder = end;
+    skip_whitespace(&remainder);
 
-    for (i = 0; i < sizeof(directives)/sizeof(directives[0]); i++) {
+    if (macro) {
+        expand_macro(pp, macro, end);
+        return FALSE;
+    }
+
+    if (directive) {
         char buf1[1024];
-        const char *remainder = matches(line, directives[i].name);
-        
-        if (remainder) {
-            if (pp->skip_depth) {
-                if (!strncmp("if", directives[i].name, 2)) {
-                    pp->skip_depth++;
-                } else if (!strcmp("endif", directives[i].name)) {
-                    pp->skip_depth--;
-                } else if (!strcmp("else", directives[i].name)) {
-                    if (pp->skip_depth == 1) {
-                        pp->skip_depth = 0;
-                        pp->depth++;
-                    }
-                }
-                return FALSE;
-            } else if (directives[i].nargs == 0) {
-                pp_fn0_t fn = (pp_fn0_t) directives[i].fn;
-                pp->fatal_error = !fn(pp, directives[i].param);
-                return FALSE;
-            } else if (directives[i].nargs == 1) {
-                pp_fn1_t fn = (pp_fn1_t) directives[i].fn;
-                skip_whitespace(&remainder);
-                pp->fatal_error = !fn(pp, directives[i].param, remainder);
-                return FALSE;
-            } else if (directives[i].nargs == 2) {
-                remainder = get_arg(pp, remainder, buf1, sizeof(buf1));
-                if (!remainder || !*remainder || !*buf1) {
-                    yasm_error_set(YASM_ERROR_SYNTAX, N_("\".%s\" expects two arguments"), directives[i].name);
-                    yasm_errwarn_propagate(pp->errwarns, pp->current_line_number);
-                    pp->fatal_error = 1;
-                } else {
-                    pp_fn2_t fn = (pp_fn2_t) directives[i].fn;
-                    pp->fatal_error = !fn(pp, directives[i].param, buf1, remainder);
+
+        if (pp->skip_depth) {
+            if (!strncmp("if", directive->name, 2)) {
+                pp->skip_depth++;
+            } else if (!strcmp("endif", directive->name)) {
+                pp->skip_depth--;
+            } else if (!strcmp("else", directive->name)) {
+                if (pp->skip_depth == 1) {
+                    pp->skip_depth = 0;
+                    pp->depth++;
                 }
-                return FALSE;
             }
+            return FALSE;
+        } else if (directive->nargs == 0) {
+            pp_fn0_t fn = (pp_fn0_t) directive->fn;
+            pp->fatal_error = !fn(pp, directive->param);
+            return FALSE;
+        } else if (directive->nargs == 1) {
+            pp_fn1_t fn = (pp_fn1_t) directive->fn;
+            pp->fatal_error = !fn(pp, directive->param, remainder);
+            return FALSE;
+        } else if (directive->nargs == 2) {
+            remainder = get_arg(pp, remainder, buf1, sizeof(buf1));
+            if (!remainder || !*remainder || !*buf1) {
+                yasm_error_set(YASM_ERROR_SYNTAX, N_("\".%s\" expects two arguments"), directive->name);
+                yasm_errwarn_propagate(pp->errwarns, pp->current_line_number);
+                pp->fatal_error = 1;
+            } else {
+                pp_fn2_t fn = (pp_fn2_t) directive->fn;
+                pp->fatal_error = !fn(pp, directive->param, buf1, remainder);
+            }
+            return FALSE;
         }
     }
 
@@ -1244,17 +1377,15 @@ gas_preproc_create(const char *in_filename, yasm_symtab *symtab,
     }
 
     pp->preproc.module = &yasm_gas_LTX_preproc;
-    pp->in = f;
     pp->in_filename = yasm__xstrdup(in_filename);
-    pp->defines = yasm_symtab_create();
-    SLIST_INIT(&pp->deferred_defines);
-    yasm_symtab_set_case_sensitive(pp->defines, 1);
+    pp->defines = HAMT_create(0, yasm_internal_error_);
+    LIST_INIT(&pp->deferred_defines);
     pp->depth = 0;
     pp->skip_depth = 0;
     pp->in_comment = FALSE;
     SLIST_INIT(&pp->buffered_lines);
     SLIST_INIT(&pp->included_files);
-    STAILQ_INIT(&pp->macros);
+    pp->macros = HAMT_create(0, yasm_internal_error_);
     pp->in_line_number = 0;
     pp->next_line_number = 0;
     pp->current_line_number = 0;
@@ -1263,6 +1394,11 @@ gas_preproc_create(const char *in_filename, yasm_symtab *symtab,
     pp->fatal_error = 0;
     pp->detect_errors_only = 0;
 
+    read_file(pp, &pp->in, f);
+    if (f != stdin) {
+        fclose(f);
+    }
+
     return (yasm_preproc *) pp;
 }
 
@@ -1270,11 +1406,12 @@ static void
 gas_preproc_destroy(yasm_preproc *preproc)
 {
     yasm_preproc_gas *pp = (yasm_preproc_gas *) preproc;
+    yasm_linereader_delete(&pp->in);
     yasm_xfree(pp->in_filename);
-    yasm_symtab_destroy(pp->defines);
-    while (!SLIST_EMPTY(&pp->deferred_defines)) {
-        deferred_define *def = SLIST_FIRST(&pp->deferred_defines);
-        SLIST_REMOVE_HEAD(&pp->deferred_defines, next);
+    HAMT_destroy(pp->defines, free_define);
+    while (!LIST_EMPTY(&pp->deferred_defines)) {
+        deferred_define *def = LIST_FIRST(&pp->deferred_defines);
+        LIST_REMOVE(def, next);
         yasm_xfree(def->name);
         yasm_xfree(def->value);
         yasm_xfree(def);
@@ -1291,19 +1428,7 @@ gas_preproc_destroy(yasm_preproc *preproc)
         yasm_xfree(inc_file->filename);
         yasm_xfree(inc_file);
     }
-    while (!STAILQ_EMPTY(&pp->macros)) {
-        int i;
-        macro_entry *macro = STAILQ_FIRST(&pp->macros);
-        STAILQ_REMOVE_HEAD(&pp->macros, next);
-        yasm_xfree(macro->name);
-        for (i = 0; i < macro->num_params; i++)
-            yasm_xfree(macro->params[i]);
-        yasm_xfree(macro->params);
-        for (i = 0; i < macro->num_lines; i++)
-            yasm_xfree(macro->lines[i]);
-        yasm_xfree(macro->lines);
-        yasm_xfree(macro);
-    }
+    HAMT_destroy(pp->macros, free_macro);
     yasm_xfree(preproc);
 }
 
@@ -1407,5 +1532,8 @@ yasm_preproc_module yasm_gas_LTX_preproc = {
     gas_preproc_predefine_macro,
     gas_preproc_undefine_macro,
     gas_preproc_define_builtin,
-    gas_preproc_add_standard
+    gas_preproc_add_standard,
+    NULL,
+    NULL,
+    NULL
 };
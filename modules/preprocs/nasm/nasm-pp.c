@@ -54,6 +54,9 @@ typedef struct Token Token;
 typedef struct Blocks Blocks;
 typedef struct Line Line;
 typedef struct Include Include;
+typedef struct IncFile IncFile;
+typedef struct IncName IncName;
+typedef struct PchLoad PchLoad;
 typedef struct Cond Cond;
 
 /*
@@ -63,6 +66,7 @@ struct SMacro
 {
     SMacro *next;
     char *name;
+    unsigned int hash;          /* hash() of name */
     int level;
     int casesense;
     int nparam;
@@ -91,6 +95,7 @@ struct MMacro
 {
     MMacro *next;
     char *name;
+    unsigned int hash;          /* hash() of name */
     int casesense;
     long nparam_min, nparam_max;
     int plus;                   /* is the last parameter greedy? */
@@ -139,6 +144,10 @@ struct Context
  * which doesn't need quotes around it. Used in the pre-include
  * mechanism as an alternative to trying to find a sensible type of
  * quote to use on the filename we were passed.
+ *
+ * Identifiers (TOK_ID and TOK_PREPROC_ID) carry the hash() of their
+ * text so that macro lookups don't need to recompute it; anything
+ * that changes the text or type of a token must call rehash_Token().
  */
 struct Token
 {
@@ -146,6 +155,7 @@ struct Token
     char *text;
     SMacro *mac;                /* associated macro for TOK_SMAC_END */
     int type;
+    unsigned int hash;          /* hash() of text, identifiers only */
 };
 enum
 {
@@ -190,7 +200,8 @@ struct Line
 struct Include
 {
     Include *next;
-    FILE *fp;
+    yasm_linereader lines;      /* contents of the file */
+    IncFile *file;              /* include cache entry, NULL for main file */
     Cond *conds;
     Line *expansion;
     char *fname;
@@ -198,6 +209,50 @@ struct Include
     MMacro *mstk;               /* stack of active macros/reps */
 };
 
+/*
+ * The include cache. Every file read by %include is kept for the
+ * rest of the run, so a file included many times is only searched
+ * for and read once. An entry also records when repeat inclusions
+ * can be skipped altogether: the file used `%pragma once', or all
+ * of it is wrapped in an include guard (`%ifndef NAME' ... `%endif')
+ * whose macro is now defined.
+ */
+struct IncFile
+{
+    IncFile *next;
+    char *path;                 /* name the file was opened by */
+    char *data;                 /* file contents */
+    size_t len;
+    char *guard;                /* include guard macro, or NULL */
+    int once;                   /* seen `%pragma once' */
+};
+
+/*
+ * Include cache lookup by the name given to %include. The name is
+ * only meaningful relative to the file it was included from.
+ */
+struct IncName
+{
+    IncName *next;
+    char *name;
+    char *from;
+    IncFile *file;
+};
+
+#define INC_NHASH 64
+
+/*
+ * A precompiled macro file named by -include-pch, waiting for its
+ * `%pragma pch' line to come up. `config' is the configuration hash
+ * the file has to match: everything set up before it was requested.
+ */
+struct PchLoad
+{
+    PchLoad *next;
+    char *fname;
+    unsigned int config;
+};
+
 /*
  * Conditional assembly: we maintain a separate stack of these for
  * each level of file inclusion. (The only reason we keep the
@@ -283,7 +338,7 @@ static const char *directives[] = {
     "%ifnstr", "%ifnum", "%ifstr", "%imacro", "%include",
     "%ixdefine", "%line",
     "%local",
-    "%macro", "%pop", "%push", "%rep", "%repl", "%rotate",
+    "%macro", "%pop", "%pragma", "%push", "%rep", "%repl", "%rotate",
     "%scope", "%stacksize",
     "%strlen", "%substr", "%undef", "%xdefine"
 };
@@ -300,7 +355,7 @@ enum
     PP_IFNSTR, PP_IFNUM, PP_IFSTR, PP_IMACRO, PP_INCLUDE,
     PP_IXDEFINE, PP_LINE,
     PP_LOCAL,
-    PP_MACRO, PP_POP, PP_PUSH, PP_REP, PP_REPL, PP_ROTATE,
+    PP_MACRO, PP_POP, PP_PRAGMA, PP_PUSH, PP_REP, PP_REPL, PP_ROTATE,
     PP_SCOPE, PP_STACKSIZE,
     PP_STRLEN, PP_SUBSTR, PP_UNDEF, PP_XDEFINE
 };
@@ -335,6 +390,15 @@ static const char *tasm_directives[] = {
     "ifndef", "include", "local"
 };
 
+/*
+ * Data and reserve pseudo-ops that may head a %rep body which is folded
+ * into a single TIMES line (see rep_fold_times()).
+ */
+static const char *rep_data_directives[] = {
+    "db", "dd", "ddq", "do", "dq", "dt", "dw", "dy", "dz",
+    "resb", "resd", "resdq", "reso", "resq", "rest", "resw", "resy", "resz"
+};
+
 static int StackSize = 4;
 static const char *StackPointer = "ebp";
 static int ArgOffset = 8;
@@ -344,8 +408,8 @@ static int Level = 0;
 
 static Context *cstk;
 static Include *istk;
-
-static FILE *first_fp = NULL;
+static IncFile *incfiles[INC_NHASH];
+static IncName *incnames[INC_NHASH];
 
 static efunc _error;            /* Pointer to client-provided error reporting function */
 static evalfunc evaluate;
@@ -359,24 +423,65 @@ static Line *stddef = NULL;
 static Line *predef = NULL;
 static int first_line = 1;
 
+/*
+ * Precompiled macro state. `config_hash' covers the include path,
+ * the mode and every builtin, standard and command line macro or
+ * include, in the order they were given; the main file is recorded
+ * so a precompiled copy of its macros can be checked against it.
+ */
+static unsigned int config_hash;
+static PchLoad *pch_loads, **pch_loads_tail = &pch_loads;
+static char *main_fname;
+static size_t main_len;
+static unsigned int main_hash;
+
 static ListGen *list;
 
 /*
- * The number of hash values we use for the macro lookup tables.
- * FIXME: We should *really* be able to configure this at run time,
- * or even have the hash table automatically expanding when necessary.
+ * The initial number of hash values we use for the macro lookup
+ * tables.  The tables are always a power of two in size, and double
+ * whenever they hold more macros than they have hash values.
  */
 #define NHASH 4096
 
 /*
  * The current set of multi-line macros we have defined.
  */
-static MMacro *mmacros[NHASH];
+static MMacro **mmacros;
+static unsigned int mmacros_size, mmacros_count;
 
 /*
  * The current set of single-line macros we have defined.
  */
-static SMacro *smacros[NHASH];
+static SMacro **smacros;
+static unsigned int smacros_size, smacros_count;
+
+#define mmacro_bucket(h)    (&mmacros[(h) & (mmacros_size - 1)])
+#define smacro_bucket(h)    (&smacros[(h) & (smacros_size - 1)])
+
+/*
+ * A Bloom filter over the hashes of all single-line macro names,
+ * global and context-local, defined since the tables were last
+ * emptied.  A clear bit proves no macro of that name exists, which
+ * lets expand_smacro() hand back lines that reference none without
+ * walking them through the expansion machinery.  Undefining a macro
+ * leaves its bits set; that only costs a false positive.
+ */
+#define SMACRO_FILTER_BITS  16384
+static unsigned char smacro_filter[SMACRO_FILTER_BITS / 8];
+
+#define smacro_filter_bit_(h) \
+    ((h) & (SMACRO_FILTER_BITS - 1))
+#define smacro_filter_set_(b) \
+    (smacro_filter[(b) >> 3] |= (unsigned char)(1 << ((b) & 7)))
+#define smacro_filter_isset_(b) \
+    (smacro_filter[(b) >> 3] & (1 << ((b) & 7)))
+#define smacro_filter_add(h) \
+    (smacro_filter_set_(smacro_filter_bit_(h)), \
+     smacro_filter_set_(smacro_filter_bit_((h) >> 16)))
+#define smacro_filter_test(h) \
+    (smacro_filter_isset_(smacro_filter_bit_(h)) && \
+     smacro_filter_isset_(smacro_filter_bit_((h) >> 16)))
 
 /*
  * The multi-line macro we are currently defining, or the %rep
@@ -474,8 +579,11 @@ static void *new_Block(size_t size);
 static void delete_Blocks(void);
 static Token *new_Token(Token * next, int type, const char *text,
                         size_t txtlen);
+static Token *copy_Token(Token * next, const Token * t);
 static Token *delete_Token(Token * t);
+static void rehash_Token(Token * t);
 static Token *tokenise(char *line);
+static void load_pch(PchLoad *pl);
 
 /*
  * Macros for safe checking of token pointers, avoid *(NULL)
@@ -1026,6 +1134,7 @@ static Token * tasm_join_tokens(Token *tline)
                 int lenn = strlen(next->text);
                 prev->text = nasm_realloc(prev->text, lenp + lenn + 1);
                 strncpy(prev->text + lenp, next->text, lenn + 1);
+                rehash_Token(prev);
                 (void) delete_Token(t);
                 prev->next = delete_Token(next);
                 t = prev;
@@ -1095,33 +1204,160 @@ prepreproc(char *line)
  * The hash function for macro lookups. Note that due to some
  * macros having case-insensitive names, the hash function must be
  * invariant under case changes. We implement this by applying a
- * perfectly normal hash function to the uppercase of the string.
+ * perfectly normal hash function (FNV-1a) to the uppercase of the
+ * string.  The full value is returned; the tables mask it down to
+ * their current size.
  */
-static int
-hash(char *s)
+static unsigned int
+hash(const char *s)
 {
-    unsigned int h = 0;
-    unsigned int i = 0;
-    /*
-     * Powers of three, mod 31.
-     */
-    static const int multipliers[] = {
-        1, 3, 9, 27, 19, 26, 16, 17, 20, 29, 25, 13, 8, 24, 10,
-        30, 28, 22, 4, 12, 5, 15, 14, 11, 2, 6, 18, 23, 7, 21
-    };
-
+    unsigned int h = 2166136261U;
 
     while (*s)
     {
-        h += multipliers[i] * (unsigned char) (toupper(*s));
-        s++;
-        if (++i >= elements(multipliers))
-            i = 0;
+        unsigned char c = (unsigned char)*s++;
+        if (c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+        h = (h ^ c) * 16777619U;
     }
-    h %= NHASH;
     return h;
 }
 
+/*
+ * Continue an exact (case-sensitive) FNV-1a hash over a buffer. Used
+ * to recognise unchanged files and configurations; start from
+ * HASH_INIT.
+ */
+#define HASH_INIT 2166136261U
+
+static unsigned int
+hash_buf(unsigned int h, const char *p, size_t len)
+{
+    while (len--)
+        h = (h ^ (unsigned char)*p++) * 16777619U;
+    return h;
+}
+
+/*
+ * Fold one configuration item into config_hash.
+ */
+static void
+config_update(const char *kind, const char *value)
+{
+    config_hash = hash_buf(config_hash, kind, strlen(kind) + 1);
+    config_hash = hash_buf(config_hash, value, strlen(value) + 1);
+}
+
+/*
+ * Allocate an empty macro hash table of the given size.
+ */
+static void *
+new_macro_table(unsigned int size)
+{
+    void **table = nasm_malloc(size * sizeof(void *));
+    unsigned int h;
+
+    for (h = 0; h < size; h++)
+        table[h] = NULL;
+    return table;
+}
+
+/*
+ * Double the size of the single-line macro table.  Each chain splits
+ * into two, and the relative order of macros within a chain (newest
+ * definitions first) is preserved.
+ */
+static void
+grow_smacros(void)
+{
+    unsigned int newsize = smacros_size * 2;
+    SMacro **newtab = new_macro_table(newsize);
+    unsigned int h;
+
+    for (h = 0; h < smacros_size; h++)
+    {
+        SMacro **lo = &newtab[h], **hi = &newtab[h + smacros_size];
+        SMacro *m = smacros[h];
+
+        while (m)
+        {
+            if (m->hash & smacros_size)
+            {
+                *hi = m;
+                hi = &m->next;
+            }
+            else
+            {
+                *lo = m;
+                lo = &m->next;
+            }
+            m = m->next;
+        }
+        *lo = NULL;
+        *hi = NULL;
+    }
+    nasm_free(smacros);
+    smacros = newtab;
+    smacros_size = newsize;
+}
+
+/*
+ * Same again for the multi-line macro table.
+ */
+static void
+grow_mmacros(void)
+{
+    unsigned int newsize = mmacros_size * 2;
+    MMacro **newtab = new_macro_table(newsize);
+    unsigned int h;
+
+    for (h = 0; h < mmacros_size; h++)
+    {
+        MMacro **lo = &newtab[h], **hi = &newtab[h + mmacros_size];
+        MMacro *m = mmacros[h];
+
+        while (m)
+        {
+            if (m->hash & mmacros_size)
+            {
+                *hi = m;
+                hi = &m->next;
+            }
+            else
+            {
+                *lo = m;
+                lo = &m->next;
+            }
+            m = m->next;
+        }
+        *lo = NULL;
+        *hi = NULL;
+    }
+    nasm_free(mmacros);
+    mmacros = newtab;
+    mmacros_size = newsize;
+}
+
+/*
+ * Allocate a new single-line macro called `name' and push it on to
+ * `smhead', which is either the local macro list of context `ctx' or,
+ * if `ctx' is NULL, a chain of the global table.  As this may grow
+ * the global table, `smhead' must not be used afterwards.
+ */
+static SMacro *
+new_smacro(Context * ctx, SMacro ** smhead, const char *name)
+{
+    SMacro *smac = nasm_malloc(sizeof(SMacro));
+
+    smac->hash = hash(name);
+    smacro_filter_add(smac->hash);
+    smac->next = *smhead;
+    *smhead = smac;
+    if (!ctx && ++smacros_count > smacros_size)
+        grow_smacros();
+    return smac;
+}
+
 /*
  * Free a linked list of tokens.
  */
@@ -1186,78 +1422,31 @@ ctx_pop(void)
     nasm_free(c);
 }
 
-#define BUF_DELTA 512
 /*
  * Read a line from the top file in istk, handling multiple CR/LFs
- * at the end of the line read, and handling spurious ^Zs. Will
- * return lines from the standard macro set if this has not already
- * been done.
+ * at the end of the line read, and handling spurious ^Zs. The line
+ * is part of the file buffer and must not be freed.
  */
 static char *
 read_line(void)
 {
-    char *buffer, *p, *q;
-    int bufsize, continued_count;
-
-    bufsize = BUF_DELTA;
-    buffer = nasm_malloc(BUF_DELTA);
-    p = buffer;
-    continued_count = 0;
-    while (1)
-    {
-        q = fgets(p, bufsize - (int)(p - buffer), istk->fp);
-        if (!q)
-            break;
-        p += strlen(p);
-        if (p > buffer && p[-1] == '\n')
-        {
-           /* Convert backslash-CRLF line continuation sequences into
-              nothing at all (for DOS and Windows) */
-           if (((p - 2) > buffer) && (p[-3] == '\\') && (p[-2] == '\r')) {
-               p -= 3;
-               *p = 0;
-               continued_count++;
-           }
-           /* Also convert backslash-LF line continuation sequences into
-              nothing at all (for Unix) */
-           else if (((p - 1) > buffer) && (p[-2] == '\\')) {
-               p -= 2;
-               *p = 0;
-               continued_count++;
-           }
-           else {
-               break;
-           }
-        }
-        if (p - buffer > bufsize - 10)
-        {
-            long offset = (long)(p - buffer);
-            bufsize += BUF_DELTA;
-            buffer = nasm_realloc(buffer, (size_t)bufsize);
-            p = buffer + offset;        /* prevent stale-pointer problems */
-        }
-    }
+    char *buffer, *p;
+    size_t len;
+    unsigned long nlines;
 
-    if (!q && p == buffer)
-    {
-        nasm_free(buffer);
+    buffer = yasm_linereader_next(&istk->lines, 1, &len, &nlines);
+    if (!buffer)
         return NULL;
-    }
 
-    nasm_src_set_linnum(nasm_src_get_linnum() + istk->lineinc + (continued_count * istk->lineinc));
-
-    /*
-     * Play safe: remove CRs as well as LFs, if any of either are
-     * present at the end of the line.
-     */
-    while (--p >= buffer && (*p == '\n' || *p == '\r'))
-        *p = '\0';
+    nasm_src_set_linnum(nasm_src_get_linnum() + (long)nlines * istk->lineinc);
 
     /*
      * Handle spurious ^Z, which may be inserted into source files
      * by some file transfer utilities.
      */
-    buffer[strcspn(buffer, "\032")] = '\0';
+    p = memchr(buffer, '\032', len);
+    if (p)
+        *p = '\0';
 
     list->line(LIST_READ, buffer);
 
@@ -1513,9 +1702,30 @@ new_Token(Token * next, int type, const char *text, size_t txtlen)
         strncpy(t->text, text, txtlen);
         t->text[txtlen] = '\0';
     }
+    rehash_Token(t);
     return t;
 }
 
+/*
+ *  Duplicate a Token, reusing its hash rather than rehashing the text.
+ */
+static Token *
+copy_Token(Token * next, const Token * t)
+{
+    Token *tt;
+
+    if (freeTokens == NULL)
+        return new_Token(next, t->type, t->text, 0);
+    tt = freeTokens;
+    freeTokens = tt->next;
+    tt->next = next;
+    tt->mac = NULL;
+    tt->type = t->type;
+    tt->text = t->text ? nasm_strdup(t->text) : NULL;
+    tt->hash = t->hash;
+    return tt;
+}
+
 static Token *
 delete_Token(Token * t)
 {
@@ -1526,6 +1736,15 @@ delete_Token(Token * t)
     return next;
 }
 
+static void
+rehash_Token(Token * t)
+{
+    if ((t->type == TOK_ID || t->type == TOK_PREPROC_ID) && t->text)
+        t->hash = hash(t->text);
+    else
+        t->hash = 0;
+}
+
 /*
  * Convert a line of tokens back into text.
  * If expand_locals is not zero, identifiers of the form "%$*xxx"
@@ -1549,6 +1768,7 @@ detoken(Token * tlist, int expand_locals)
                 t->text = nasm_strdup(p2);
             else
                 t->text = NULL;
+            rehash_Token(t);
         }
         /* Expand local macros here and not during preprocessing */
         if (expand_locals &&
@@ -1566,6 +1786,7 @@ detoken(Token * tlist, int expand_locals)
                 p2 = nasm_strcat(buffer, q);
                 nasm_free(t->text);
                 t->text = p2;
+                rehash_Token(t);
             }
         }
         if (t->type == TOK_WHITESPACE)
@@ -1869,6 +2090,277 @@ inc_fopen(char *file, char **newname)
     return fp;
 }
 
+/*
+ * Return the index of the directive a line of text starts with, or
+ * -1 if it does not start with one. *end is set past the directive
+ * name.
+ */
+static int
+line_directive(const char *p, const char **end)
+{
+    char name[16];
+    size_t len;
+    int i, j, k, m;
+
+    *end = p;
+    if (*p != '%' || !isidchar(p[1]))
+        return -1;
+    len = 1;
+    while (isidchar(p[len]))
+        len++;
+    *end = p + len;
+    if (len >= sizeof(name))
+        return -1;
+    memcpy(name, p, len);
+    name[len] = '\0';
+
+    i = -1;
+    j = elements(directives);
+    while (j - i > 1)
+    {
+        k = (j + i) / 2;
+        m = nasm_stricmp(name, directives[k]);
+        if (m == 0)
+            return k;
+        else if (m < 0)
+            j = k;
+        else
+            i = k;
+    }
+    return -1;
+}
+
+/*
+ * Check whether the rest of a line is blank or a comment.
+ */
+static int
+line_is_blank(const char *p)
+{
+    while (isspace(*p))
+        p++;
+    return !*p || *p == ';';
+}
+
+/*
+ * Find the include guard of a file: the macro tested by an %ifndef
+ * that, ignoring blank and comment lines, opens the file and is
+ * closed by an %endif at its very end, with no %else or %elif at
+ * the outer level. Returns NULL if the file is not guarded this way.
+ *
+ * When the guard macro is defined, the whole file is a non-emitting
+ * conditional, so including it again can have no effect. To keep
+ * that true, any line the preprocessor would still look at in a
+ * non-emitting block (another %else or %endif with trailing text,
+ * or a `%{...}' directive) makes the file unguarded.
+ */
+static char *
+find_include_guard(const char *data, size_t len)
+{
+    yasm_linereader lr;
+    char *line, *guard = NULL;
+    const char *p, *q;
+    size_t linelen;
+    unsigned long nlines;
+    int i, depth = 0, done = FALSE, ok = TRUE;
+
+    yasm_linereader_initialize_buf(&lr, data, len);
+    while (ok && (line = yasm_linereader_next(&lr, 1, &linelen, &nlines)))
+    {
+        p = line;
+        while (isspace(*p))
+            p++;
+        if (line_is_blank(p))
+            continue;
+        if (p[0] == '%' && p[1] == '{')
+        {
+            ok = FALSE;
+            break;
+        }
+        i = line_directive(p, &q);
+
+        if (depth == 0)
+        {
+            /* Only the guard itself may be at the outer level */
+            if (done || i != PP_IFNDEF)
+            {
+                ok = FALSE;
+                break;
+            }
+            while (isspace(*q))
+                q++;
+            p = q;
+            if (!isidstart(*q))
+            {
+                ok = FALSE;
+                break;
+            }
+            while (isidchar(*q))
+                q++;
+            if (!line_is_blank(q))
+            {
+                ok = FALSE;
+                break;
+            }
+            guard = nasm_malloc((size_t)(q - p) + 1);
+            memcpy(guard, p, (size_t)(q - p));
+            guard[q - p] = '\0';
+            depth = 1;
+        }
+        else if (i == PP_ELSE || i == PP_ENDIF)
+        {
+            if (!line_is_blank(q) || (i == PP_ELSE && depth == 1))
+                ok = FALSE;
+            else if (i == PP_ENDIF && --depth == 0)
+                done = TRUE;
+        }
+        else if (i >= PP_IF && i <= PP_IFSTR)
+            depth++;
+        else if (i >= PP_ELIF && i <= PP_ELIFSTR && depth == 1)
+            ok = FALSE;
+    }
+    yasm_linereader_delete(&lr);
+
+    if (!ok || !done)
+    {
+        nasm_free(guard);
+        return NULL;
+    }
+    return guard;
+}
+
+/*
+ * Find the include cache entry of a file by the path it was opened by.
+ */
+static IncFile *
+find_inc_file(const char *path)
+{
+    IncFile *f;
+
+    for (f = incfiles[hash(path) & (INC_NHASH - 1)]; f; f = f->next)
+        if (!strcmp(f->path, path))
+            break;
+    return f;
+}
+
+/*
+ * Add the contents of a file to the include cache. The cache takes
+ * over `data', which must have been allocated by yasm_xmalloc().
+ */
+static IncFile *
+new_inc_file(const char *path, char *data, size_t len)
+{
+    unsigned int h = hash(path) & (INC_NHASH - 1);
+    IncFile *f = nasm_malloc(sizeof(IncFile));
+
+    f->path = nasm_strdup(path);
+    f->data = data;
+    f->len = len;
+    f->guard = tasm_compatible_mode ? NULL : find_include_guard(data, len);
+    f->once = FALSE;
+    f->next = incfiles[h];
+    incfiles[h] = f;
+    return f;
+}
+
+/*
+ * Record that `name' included from `from' finds the cached file `f',
+ * unless that is already known.
+ */
+static void
+add_inc_name(const char *name, const char *from, IncFile *f)
+{
+    unsigned int h = hash(name) & (INC_NHASH - 1);
+    IncName *n;
+
+    for (n = incnames[h]; n; n = n->next)
+        if (!strcmp(n->name, name) && !strcmp(n->from, from))
+            return;
+    n = nasm_malloc(sizeof(IncName));
+    n->name = nasm_strdup(name);
+    n->from = nasm_strdup(from);
+    n->file = f;
+    n->next = incnames[h];
+    incnames[h] = n;
+}
+
+/*
+ * Find the file named by an %include, going through the include
+ * cache. Like inc_fopen(), this does not return if the file cannot
+ * be found. *newname is set to a copy of the path it was found at.
+ */
+static IncFile *
+inc_lookup(char *file, char **newname)
+{
+    const char *from = nasm_src_get_fname();
+    unsigned int h = hash(file) & (INC_NHASH - 1);
+    IncName *n;
+    IncFile *f;
+    FILE *fp;
+    yasm_linereader lr;
+
+    if (!from)
+        from = "";
+    for (n = incnames[h]; n; n = n->next)
+    {
+        if (!strcmp(n->name, file) && !strcmp(n->from, from))
+        {
+            nasm_preproc_add_dep(n->file->path);
+            *newname = nasm_strdup(n->file->path);
+            return n->file;
+        }
+    }
+
+    n = nasm_malloc(sizeof(IncName));
+    n->name = nasm_strdup(file);
+    n->from = nasm_strdup(from);
+
+    fp = inc_fopen(file, newname);
+    f = find_inc_file(*newname);
+    if (f)
+        fclose(fp);     /* already read under another name */
+    else
+    {
+        yasm_linereader_initialize(&lr, fp);
+        fclose(fp);
+        f = new_inc_file(*newname, lr.buf, (size_t)(lr.lim - lr.buf));
+    }
+
+    n->file = f;
+    n->next = incnames[h];
+    incnames[h] = n;
+    return f;
+}
+
+/*
+ * Free the include cache.
+ */
+static void
+free_inc_cache(void)
+{
+    int h;
+
+    for (h = 0; h < INC_NHASH; h++)
+    {
+        while (incnames[h])
+        {
+            IncName *n = incnames[h];
+            incnames[h] = n->next;
+            nasm_free(n->name);
+            nasm_free(n->from);
+            nasm_free(n);
+        }
+        while (incfiles[h])
+        {
+            IncFile *f = incfiles[h];
+            incfiles[h] = f->next;
+            nasm_free(f->path);
+            yasm_xfree(f->data);
+            nasm_free(f->guard);
+            nasm_free(f);
+        }
+    }
+}
+
 /*
  * Determine if we should warn on defining a single-line macro of
  * name `name', with `nparam' parameters. If nparam is 0 or -1, will
@@ -1896,6 +2388,7 @@ smacro_defined(Context * ctx, char *name, int nparam, SMacro ** defn,
 {
     SMacro *m;
     int highest_level = -1;
+    unsigned int h = hash(name);
 
     if (ctx)
         m = ctx->localmac;
@@ -1908,11 +2401,11 @@ smacro_defined(Context * ctx, char *name, int nparam, SMacro ** defn,
         m = ctx->localmac;
     }
     else
-        m = smacros[hash(name)];
+        m = *smacro_bucket(h);
 
     while (m)
     {
-        if (!mstrcmp(m->name, name, m->casesense && nocase) &&
+        if (m->hash == h && !mstrcmp(m->name, name, m->casesense && nocase) &&
                 (nparam <= 0 || m->nparam == 0 || nparam == m->nparam) && (highest_level < 0 || m->level > highest_level))
         {
             highest_level = m->level;
@@ -2198,7 +2691,7 @@ if_condition(Token * tline, int i)
                 tline = tline->next;
                 searching.plus = TRUE;
             }
-            mmac = mmacros[hash(searching.name)];
+            mmac = *mmacro_bucket(hash(searching.name));
             while (mmac)
             {
                 if (!strcmp(mmac->name, searching.name) &&
@@ -2318,15 +2811,92 @@ expand_macros_in_string(char **p)
     while (line);
 }
 
-/**
- * find and process preprocessor directive in passed line
- * Find out if a line contains a preprocessor directive, and deal
- * with it if so.
- * 
- * If a directive _is_ found, it is the responsibility of this routine
- * (and not the caller) to free_tlist() the line.
+/*
+ * A %rep body consisting of one data line that no macro can touch
+ * (e.g. "%rep 4096 / db 0x90 / %endrep") expands to the same line on
+ * every iteration. Rewrite such a body into "times N <line>" and let
+ * the block run once: the parser then emits a single multiple-
+ * instance bytecode instead of N copies of the line.
  *
- * @param tline a pointer to the current tokeninzed line linked list
+ * The body must be a single line headed by a data or reserve
+ * pseudo-op; every other token must be a literal or an identifier
+ * that is not a single-line macro. Anything depending on the
+ * iteration ($, preprocessor tokens, labels) keeps the plain replay.
+ *
+ * Folding is visible in list files, which show the single TIMES line.
+ * It is not done when only preprocessing, so that -e output still
+ * shows every iteration.
+ */
+static void
+rep_fold_times(MMacro * m)
+{
+    Line *l = m->expansion;
+    Token *t, *head;
+    MMacro *mm;
+    char buf[32];
+    int i;
+
+    if (nasm_preproc_only || m->in_progress <= 2 || !l || l->next ||
+            l->finishes)
+        return;
+
+    t = l->first;
+    skip_white_(t);
+    if (!tok_type_(t, TOK_ID))
+        return;
+    for (i = 0; i < elements(rep_data_directives); i++)
+        if (!nasm_stricmp(t->text, rep_data_directives[i]))
+            break;
+    if (i == elements(rep_data_directives))
+        return;
+    for (mm = *mmacro_bucket(t->hash); mm; mm = mm->next)
+        if (!mstrcmp(mm->name, t->text, mm->casesense))
+            return;
+    for (mm = *mmacro_bucket(hash("times")); mm; mm = mm->next)
+        if (!mstrcmp(mm->name, "times", mm->casesense))
+            return;
+    if (smacro_defined(NULL, "times", 0, NULL, TRUE))
+        return;
+
+    for (; t; t = t->next)
+    {
+        switch (t->type)
+        {
+            case TOK_WHITESPACE:
+            case TOK_STRING:
+            case TOK_OTHER:
+                break;
+            case TOK_NUMBER:
+                if (t->text[0] == '$')
+                    return;
+                break;
+            case TOK_ID:
+                if (smacro_defined(NULL, t->text, 0, NULL, TRUE))
+                    return;
+                break;
+            default:
+                return;
+        }
+    }
+
+    sprintf(buf, "%d", m->in_progress - 1);
+    head = new_Token(NULL, TOK_ID, "times", 5);
+    head->next = new_Token(NULL, TOK_WHITESPACE, NULL, 0);
+    head->next->next = new_Token(NULL, TOK_NUMBER, buf, 0);
+    head->next->next->next = new_Token(l->first, TOK_WHITESPACE, NULL, 0);
+    l->first = head;
+    m->in_progress = 2;
+}
+
+/**
+ * find and process preprocessor directive in passed line
+ * Find out if a line contains a preprocessor directive, and deal
+ * with it if so.
+ * 
+ * If a directive _is_ found, it is the responsibility of this routine
+ * (and not the caller) to free_tlist() the line.
+ *
+ * @param tline a pointer to the current tokeninzed line linked list
  * @return DIRECTIVE_FOUND or NO_DIRECTIVE_FOUND
  * 
  */
@@ -2337,6 +2907,7 @@ do_directive(Token * tline)
     int offset;
     char *p, *mname, *newname;
     Include *inc;
+    IncFile *incfile;
     Context *ctx;
     Cond *cond;
     SMacro *smac, **smhead;
@@ -2690,7 +3261,7 @@ do_directive(Token * tline)
             if (tline->next)
                 error(ERR_WARNING,
                         "trailing garbage after `%%clear' ignored");
-            for (j = 0; j < NHASH; j++)
+            for (j = 0; j < (int)mmacros_size; j++)
             {
                 while (mmacros[j])
                 {
@@ -2698,6 +3269,10 @@ do_directive(Token * tline)
                     mmacros[j] = m2->next;
                     free_mmacro(m2);
                 }
+            }
+            mmacros_count = 0;
+            for (j = 0; j < (int)smacros_size; j++)
+            {
                 while (smacros[j])
                 {
                     SMacro *s = smacros[j];
@@ -2707,6 +3282,7 @@ do_directive(Token * tline)
                     nasm_free(s);
                 }
             }
+            smacros_count = 0;
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
@@ -2731,11 +3307,22 @@ do_directive(Token * tline)
             else
                 p = tline->text;        /* internal_string is easier */
             expand_macros_in_string(&p);
+            incfile = inc_lookup(p, &newname);
+            nasm_free(p);
+            if (incfile->once || (incfile->guard &&
+                        smacro_defined(NULL, incfile->guard, 0, NULL, 1)))
+            {
+                /* nothing in the file would be seen: skip it */
+                nasm_free(newname);
+                free_tlist(origline);
+                return DIRECTIVE_FOUND;
+            }
             inc = nasm_malloc(sizeof(Include));
             inc->next = istk;
             inc->conds = NULL;
-            inc->fp = inc_fopen(p, &newname);
-            nasm_free(p);
+            inc->file = incfile;
+            yasm_linereader_initialize_buf(&inc->lines, incfile->data,
+                                           incfile->len);
             inc->fname = nasm_src_set_fname(newname);
             inc->lineno = nasm_src_set_linnum(0);
             inc->lineinc = 1;
@@ -2746,6 +3333,42 @@ do_directive(Token * tline)
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
+        case PP_PRAGMA:
+            tline = tline->next;
+            skip_white_(tline);
+            if (tok_type_(tline, TOK_ID) && !nasm_stricmp(tline->text, "once"))
+            {
+                if (istk->file)
+                    istk->file->once = TRUE;
+            }
+            else if (tok_type_(tline, TOK_ID) &&
+                    !nasm_stricmp(tline->text, "pch"))
+            {
+                /*
+                 * Only pp_pre_include_pch() can produce an internal
+                 * string here; those come up in the order they were
+                 * queued.
+                 */
+                tline = tline->next;
+                skip_white_(tline);
+                if (tok_type_(tline, TOK_INTERNAL_STRING) && pch_loads)
+                {
+                    PchLoad *pl = pch_loads;
+
+                    pch_loads = pl->next;
+                    if (!pch_loads)
+                        pch_loads_tail = &pch_loads;
+                    free_tlist(origline);
+                    load_pch(pl);
+                    nasm_free(pl->fname);
+                    nasm_free(pl);
+                    return DIRECTIVE_FOUND;
+                }
+            }
+            /* any other pragma is silently ignored */
+            free_tlist(origline);
+            return DIRECTIVE_FOUND;
+
         case PP_PUSH:
             tline = tline->next;
             skip_white_(tline);
@@ -2815,7 +3438,7 @@ do_directive(Token * tline)
                         "`%%endscope': already popped all levels");
             else
             {
-                for (k = 0; k < NHASH; k++)
+                for (k = 0; k < (int)smacros_size; k++)
                 {
                     SMacro **smlast = &smacros[k];
                     smac = smacros[k];
@@ -2833,6 +3456,7 @@ do_directive(Token * tline)
                             free_tlist(smac->expansion);
                             nasm_free(smac);
                             smac = *smlast;
+                            smacros_count--;
                         }
                     }
                 }
@@ -3057,7 +3681,8 @@ do_directive(Token * tline)
                 tline = tline->next;
                 defining->nolist = TRUE;
             }
-            mmac = mmacros[hash(defining->name)];
+            defining->hash = hash(defining->name);
+            mmac = *mmacro_bucket(defining->hash);
             while (mmac)
             {
                 if (!strcmp(mmac->name, defining->name) &&
@@ -3100,10 +3725,11 @@ do_directive(Token * tline)
                         tline->text);
                 return DIRECTIVE_FOUND;
             }
-            k = hash(defining->name);
-            defining->next = mmacros[k];
-            mmacros[k] = defining;
+            defining->next = *mmacro_bucket(defining->hash);
+            *mmacro_bucket(defining->hash) = defining;
             defining = NULL;
+            if (++mmacros_count > mmacros_size)
+                grow_mmacros();
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
@@ -3240,6 +3866,7 @@ do_directive(Token * tline)
              * continues) until the whole expansion is forcibly removed
              * from istk->expansion by a %exitrep.
              */
+            rep_fold_times(defining);
             l = nasm_malloc(sizeof(Line));
             l->next = istk->expansion;
             l->finishes = defining;
@@ -3292,7 +3919,7 @@ do_directive(Token * tline)
 
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = smacro_bucket(tline->hash);
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3397,17 +4024,11 @@ do_directive(Token * tline)
                     free_tlist(smac->expansion);
                 }
                 else
-                {
-                    smac = nasm_malloc(sizeof(SMacro));
-                    smac->next = *smhead;
-                    *smhead = smac;
-                }
+                    smac = new_smacro(ctx, smhead, mname);
             }
             else
             {
-                smac = nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(ctx, smhead, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = ((i == PP_DEFINE) || (i == PP_XDEFINE));
@@ -3439,7 +4060,7 @@ do_directive(Token * tline)
             /* Find the context that symbol belongs to */
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = smacro_bucket(tline->hash);
             else
                 smhead = &ctx->localmac;
 
@@ -3459,6 +4080,8 @@ do_directive(Token * tline)
                     nasm_free(smac->name);
                     free_tlist(smac->expansion);
                     nasm_free(smac);
+                    if (!ctx)
+                        smacros_count--;
                 }
             }
             free_tlist(origline);
@@ -3479,7 +4102,7 @@ do_directive(Token * tline)
             }
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = smacro_bucket(tline->hash);
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3530,9 +4153,7 @@ do_directive(Token * tline)
             }
             else
             {
-                smac = nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(ctx, smhead, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = (i == PP_STRLEN);
@@ -3559,7 +4180,7 @@ do_directive(Token * tline)
             }
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = smacro_bucket(tline->hash);
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3616,6 +4237,7 @@ do_directive(Token * tline)
             yasm_expr_destroy(evalresult);
             macro_start->type = TOK_STRING;
             macro_start->mac = NULL;
+            rehash_Token(macro_start);
 
             /*
              * We now have a macro name, an implicit parameter count of
@@ -3641,9 +4263,7 @@ do_directive(Token * tline)
             }
             else
             {
-                smac = nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(ctx, smhead, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = (i == PP_SUBSTR);
@@ -3673,7 +4293,7 @@ do_directive(Token * tline)
             }
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = smacro_bucket(tline->hash);
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3737,9 +4357,7 @@ do_directive(Token * tline)
             }
             else
             {
-                smac = nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(ctx, smhead, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = (i == PP_ASSIGN);
@@ -4036,6 +4654,7 @@ expand_mmac_params(Token * tline)
                 nasm_free(t->text);
                 t->text = text;
                 t->mac = NULL;
+                rehash_Token(t);
             }
             continue;
         }
@@ -4065,6 +4684,7 @@ expand_mmac_params(Token * tline)
                     nasm_free(t->text);
                     t->text = tmp;
                     t->next = delete_Token(tt);
+                    rehash_Token(t);
                 }
                 break;
             case TOK_NUMBER:
@@ -4074,6 +4694,7 @@ expand_mmac_params(Token * tline)
                     nasm_free(t->text);
                     t->text = tmp;
                     t->next = delete_Token(tt);
+                    rehash_Token(t);
                 }
                 break;
         }
@@ -4081,6 +4702,43 @@ expand_mmac_params(Token * tline)
     return thead;
 }
 
+/*
+ * Decide whether expand_smacro() has any work to do on a line: some
+ * identifier may name a single-line macro, a macro end marker needs
+ * removing, or tokens need pasting together.  Context-local names
+ * whose lookup would report an error are always passed on, so the
+ * error is not lost.
+ */
+static int
+smacro_candidates(const Token * t)
+{
+    for (; t; t = t->next)
+    {
+        switch (t->type)
+        {
+            case TOK_SMAC_END:
+                return TRUE;
+            case TOK_PREPROC_ID:
+                if (t->text[1] == '+' && t->text[2] == '\0')
+                    return TRUE;
+                if (t->text[1] == '$' && (!cstk || t->text[2] == '$'))
+                    return TRUE;
+                /* fall through */
+            case TOK_ID:
+                if (smacro_filter_test(t->hash))
+                    return TRUE;
+                if (t->next && (t->next->type == TOK_ID ||
+                                t->next->type == TOK_PREPROC_ID ||
+                                t->next->type == TOK_NUMBER))
+                    return TRUE;
+                break;
+            default:
+                break;
+        }
+    }
+    return FALSE;
+}
+
 /*
  * Expand all single-line macro calls made in the given line.
  * Return the expanded version of the line. The original is deemed
@@ -4100,6 +4758,9 @@ expand_smacro(Token * tline)
     Context *ctx;
     char *mname;
 
+    if (!smacro_candidates(tline))
+        return tline;
+
     /*
      * Trick: we should avoid changing the start token pointer since it can
      * be contained in "next" field of other token. Because of this
@@ -4130,7 +4791,9 @@ expand_smacro(Token * tline)
             else
                 ctx = NULL;
             if (!ctx)
-                head = smacros[hash(mname)];
+                head = *smacro_bucket(tline->type == TOK_ID ||
+                        tline->type == TOK_PREPROC_ID ? tline->hash :
+                        hash(mname));
             else
                 head = ctx->localmac;
             /*
@@ -4162,6 +4825,7 @@ expand_smacro(Token * tline)
                             nasm_src_get(&num, &(tline->text));
                             nasm_quote(&(tline->text));
                             tline->type = TOK_STRING;
+                            rehash_Token(tline);
                             continue;
                         }
                         if (!strcmp("__LINE__", m->name))
@@ -4417,6 +5081,7 @@ expand_smacro(Token * tline)
             nasm_free(t->text);
             t->next = delete_Token(t->next);
             t->text = p;
+            rehash_Token(t);
             rescan = 1;
         }
         else if (t->next->type == TOK_WHITESPACE && t->next->next &&
@@ -4539,7 +5204,7 @@ is_mmacro(Token * tline, Token *** params_array)
     Token **params;
     int nparam;
 
-    head = mmacros[hash(tline->text)];
+    head = *mmacro_bucket(tline->hash);
 
     /*
      * Efficiency: first we see if any macro exists with the given
@@ -4838,9 +5503,6 @@ static void
 pp_reset(FILE *f, const char *file, int apass, efunc errfunc, evalfunc eval,
         ListGen * listgen)
 {
-    int h;
-
-    first_fp = f;
     _error = errfunc;
     cstk = NULL;
     istk = nasm_malloc(sizeof(Include));
@@ -4848,20 +5510,35 @@ pp_reset(FILE *f, const char *file, int apass, efunc errfunc, evalfunc eval,
     istk->conds = NULL;
     istk->expansion = NULL;
     istk->mstk = NULL;
-    istk->fp = f;
+    yasm_linereader_initialize(&istk->lines, f);
+    istk->file = NULL;
     istk->fname = NULL;
+    main_fname = nasm_strdup(file);
+    main_len = (size_t)(istk->lines.lim - istk->lines.buf);
+    main_hash = hash_buf(HASH_INIT, istk->lines.buf, main_len);
     nasm_free(nasm_src_set_fname(nasm_strdup(file)));
     nasm_src_set_linnum(0);
     istk->lineinc = 1;
     defining = NULL;
     nested_mac_count = 0;
     nested_rep_count = 0;
-    for (h = 0; h < NHASH; h++)
+    nasm_free(mmacros);
+    nasm_free(smacros);
+    mmacros_size = smacros_size = NHASH;
+    mmacros = new_macro_table(mmacros_size);
+    smacros = new_macro_table(smacros_size);
+    mmacros_count = smacros_count = 0;
+    memset(smacro_filter, 0, sizeof(smacro_filter));
+    unique = 0;
+    config_hash = HASH_INIT;
     {
-        mmacros[h] = NULL;
-        smacros[h] = NULL;
+        void *iter = NULL;
+        const char *dir;
+
+        while ((dir = yasm_get_include_dir(&iter)) != NULL)
+            config_update("-I", dir);
     }
-    unique = 0;
+    config_update("mode", tasm_compatible_mode ? "tasm" : "nasm");
     if (tasm_compatible_mode) {
         pp_extra_stdmac(tasm_compat_macros);
     }
@@ -4875,27 +5552,18 @@ pp_reset(FILE *f, const char *file, int apass, efunc errfunc, evalfunc eval,
  * Nasty hack: here we push the contents of `predef' on
  * to the top-level expansion stack, since this is the
  * most convenient way to implement the pre-include and
- * pre-define features.
+ * pre-define features. The lines are only needed once,
+ * so they are moved rather than copied.
  */
 static void
-poke_predef(Line *predef_lines)
+poke_predef(Line **predef_lines)
 {
-    Line *pd, *l;
-    Token *head, **tail, *t;
+    Line *l;
 
-    for (pd = predef_lines; pd; pd = pd->next)
+    while ((l = *predef_lines) != NULL)
     {
-        head = NULL;
-        tail = &head;
-        for (t = pd->first; t; t = t->next)
-        {
-            *tail = new_Token(NULL, t->type, t->text, 0);
-            tail = &(*tail)->next;
-        }
-        l = nasm_malloc(sizeof(Line));
+        *predef_lines = l->next;
         l->next = istk->expansion;
-        l->first = head;
-        l->finishes = FALSE;
         istk->expansion = l;
     }
 }
@@ -4917,9 +5585,9 @@ pp_getline(void)
         if (first_line)
         {
             /* Reverse order */
-            poke_predef(predef);
-            poke_predef(stddef);
-            poke_predef(builtindef);
+            poke_predef(&predef);
+            poke_predef(&stddef);
+            poke_predef(&builtindef);
             first_line = 0;
         }
 
@@ -4960,7 +5628,7 @@ pp_getline(void)
                     {
                         if (t->text || t->type == TOK_WHITESPACE)
                         {
-                            tt = *tail = new_Token(NULL, t->type, t->text, 0);
+                            tt = *tail = copy_Token(NULL, t);
                             tail = &tt->next;
                         }
                     }
@@ -5033,9 +5701,15 @@ pp_getline(void)
             line = read_line();
             if (line)
             {                   /* from the current input file */
-                line = prepreproc(line);
-                tline = tokenise(line);
-                nasm_free(line);
+                if (tasm_compatible_mode || (line[0] == '#' && line[1] == ' '))
+                {
+                    /* prepreproc() may replace the line, so give it a copy */
+                    line = prepreproc(nasm_strdup(line));
+                    tline = tokenise(line);
+                    nasm_free(line);
+                }
+                else
+                    tline = tokenise(line);
                 break;
             }
             /*
@@ -5043,8 +5717,7 @@ pp_getline(void)
              */
             {
                 Include *i = istk;
-                if (i->fp != first_fp)
-                    fclose(i->fp);
+                yasm_linereader_delete(&i->lines);
                 if (i->conds)
                     error(ERR_FATAL, "expected `%%endif' before end of file");
                 /* only set line and file name if there's a next node */
@@ -5147,24 +5820,18 @@ pp_getline(void)
     return line;
 }
 
+/*
+ * Free every multi-line and global single-line macro, and the
+ * context stack with its local macros, leaving the tables empty.
+ */
 static void
-pp_cleanup(int pass_)
+free_macros(void)
 {
-    int h;
+    unsigned int h;
 
-    if (pass_ == 1)
-    {
-        if (defining)
-        {
-            error(ERR_NONFATAL, "end of file while still defining macro `%s'",
-                    defining->name);
-            free_mmacro(defining);
-        }
-        return;
-    }
     while (cstk)
         ctx_pop();
-    for (h = 0; h < NHASH; h++)
+    for (h = 0; h < mmacros_size; h++)
     {
         while (mmacros[h])
         {
@@ -5172,6 +5839,9 @@ pp_cleanup(int pass_)
             mmacros[h] = mmacros[h]->next;
             free_mmacro(m);
         }
+    }
+    for (h = 0; h < smacros_size; h++)
+    {
         while (smacros[h])
         {
             SMacro *s = smacros[h];
@@ -5181,15 +5851,48 @@ pp_cleanup(int pass_)
             nasm_free(s);
         }
     }
+    mmacros_count = smacros_count = 0;
+    memset(smacro_filter, 0, sizeof(smacro_filter));
+}
+
+static void
+pp_cleanup(int pass_)
+{
+    if (pass_ == 1)
+    {
+        if (defining)
+        {
+            error(ERR_NONFATAL, "end of file while still defining macro `%s'",
+                    defining->name);
+            free_mmacro(defining);
+        }
+        return;
+    }
+    free_macros();
+    nasm_free(mmacros);
+    nasm_free(smacros);
+    mmacros = NULL;
+    smacros = NULL;
+    mmacros_size = smacros_size = 0;
     while (istk)
     {
         Include *i = istk;
         istk = istk->next;
-        if (i->fp != first_fp)
-            fclose(i->fp);
+        yasm_linereader_delete(&i->lines);
         nasm_free(i->fname);
         nasm_free(i);
     }
+    free_inc_cache();
+    while (pch_loads)
+    {
+        PchLoad *p = pch_loads;
+        pch_loads = p->next;
+        nasm_free(p->fname);
+        nasm_free(p);
+    }
+    pch_loads_tail = &pch_loads;
+    nasm_free(main_fname);
+    main_fname = NULL;
     while (cstk)
         ctx_pop();
     if (pass_ == 0)
@@ -5213,6 +5916,8 @@ pp_pre_include(const char *fname)
     Token *inc, *space, *name;
     Line *l;
 
+    config_update("-P", fname);
+
     name = new_Token(NULL, TOK_INTERNAL_STRING, fname, 0);
     space = new_Token(name, TOK_WHITESPACE, NULL, 0);
     inc = new_Token(space, TOK_PREPROC_ID, "%include", 0);
@@ -5224,6 +5929,38 @@ pp_pre_include(const char *fname)
     predef = l;
 }
 
+/*
+ * Queue a precompiled macro file for loading, at the point where the
+ * macros so far have been defined.
+ */
+void
+pp_pre_include_pch(const char *fname)
+{
+    Token *pragma, *space, *pch, *name;
+    PchLoad *pl;
+    Line *l;
+
+    pl = nasm_malloc(sizeof(PchLoad));
+    pl->next = NULL;
+    pl->fname = nasm_strdup(fname);
+    pl->config = config_hash;
+    *pch_loads_tail = pl;
+    pch_loads_tail = &pl->next;
+    config_update("-include-pch", fname);
+
+    name = new_Token(NULL, TOK_INTERNAL_STRING, fname, 0);
+    space = new_Token(name, TOK_WHITESPACE, NULL, 0);
+    pch = new_Token(space, TOK_ID, "pch", 0);
+    space = new_Token(pch, TOK_WHITESPACE, NULL, 0);
+    pragma = new_Token(space, TOK_PREPROC_ID, "%pragma", 0);
+
+    l = nasm_malloc(sizeof(Line));
+    l->next = predef;
+    l->first = pragma;
+    l->finishes = FALSE;
+    predef = l;
+}
+
 void
 pp_pre_define(char *definition)
 {
@@ -5231,6 +5968,8 @@ pp_pre_define(char *definition)
     Line *l;
     char *equals;
 
+    config_update("-D", definition);
+
     equals = strchr(definition, '=');
     space = new_Token(NULL, TOK_WHITESPACE, NULL, 0);
     def = new_Token(space, TOK_PREPROC_ID, "%define", 0);
@@ -5253,6 +5992,8 @@ pp_pre_undefine(char *definition)
     Token *def, *space;
     Line *l;
 
+    config_update("-U", definition);
+
     space = new_Token(NULL, TOK_WHITESPACE, NULL, 0);
     def = new_Token(space, TOK_PREPROC_ID, "%undef", 0);
     space->next = tokenise(definition);
@@ -5271,6 +6012,8 @@ pp_builtin_define(char *definition)
     Line *l;
     char *equals;
 
+    config_update("builtin", definition);
+
     equals = strchr(definition, '=');
     space = new_Token(NULL, TOK_WHITESPACE, NULL, 0);
     def = new_Token(space, TOK_PREPROC_ID, "%define", 0);
@@ -5287,6 +6030,33 @@ pp_builtin_define(char *definition)
     builtindef = l;
 }
 
+/*
+ * Standard macro packages built by genmacro have their lines already
+ * split into tokens: SPLIT_MARK, then for each token its type as a
+ * single byte followed by its text (see tools/genmacro/genmacro.c).
+ */
+#define SPLIT_MARK '\177'
+
+static Token *
+split_tokens(const char *line)
+{
+    Token *list_ = NULL;
+    Token **tail = &list_;
+    const char *p;
+    int type;
+
+    while (*line)
+    {
+        type = (unsigned char)*line++;
+        for (p = line; (unsigned char)*p >= ' '; p++)
+            ;
+        *tail = new_Token(NULL, type, line, (size_t)(p - line));
+        tail = &(*tail)->next;
+        line = p;
+    }
+    return list_;
+}
+
 void
 pp_extra_stdmac(const char **macros)
 {
@@ -5298,9 +6068,15 @@ pp_extra_stdmac(const char **macros)
         Token *t;
         Line *l;
 
-        macro = nasm_strdup(*lp);
-        t = tokenise(macro);
-        nasm_free(macro);
+        config_update("stdmac", *lp);
+        if (**lp == SPLIT_MARK)
+            t = split_tokens(*lp + 1);
+        else
+        {
+            macro = nasm_strdup(*lp);
+            t = tokenise(macro);
+            nasm_free(macro);
+        }
 
         l = nasm_malloc(sizeof(Line));
         l->next = stddef;
@@ -5310,11 +6086,561 @@ pp_extra_stdmac(const char **macros)
     }
 }
 
+/*
+ * Precompiled macros.
+ *
+ * A precompiled macro file holds the state the preprocessor was left
+ * in after reading a header on its own: the global single-line and
+ * multi-line macros, the context stack and the include cache. Loading
+ * it stands in for reading the header again, which is only valid if
+ * that would come out the same, so the file also records the
+ * configuration hash it was made with and the length and hash of each
+ * file that was read.
+ *
+ * Numbers are stored as 32-bit little-endian values. Strings are
+ * stored as their length plus one (zero for a NULL string), followed
+ * by the text and its terminating NUL.
+ */
+#define PCH_MAGIC       "YASMPCH"
+#define PCH_VERSION     1
+
+typedef struct PchBuf
+{
+    const unsigned char *p, *lim;
+    int bad;
+} PchBuf;
+
+/*
+ * A file recorded in a precompiled macro file, and the contents it
+ * has now.
+ */
+typedef struct PchFile
+{
+    const char *path;
+    char *data;                 /* NULL if already in the include cache */
+    size_t len;
+    int once;
+} PchFile;
+
+static void
+pch_put_str(FILE *f, const char *s)
+{
+    size_t len;
+
+    if (!s)
+    {
+        yasm_fwrite_32_l(0, f);
+        return;
+    }
+    len = strlen(s);
+    yasm_fwrite_32_l((unsigned long)len + 1, f);
+    fwrite(s, len + 1, 1, f);
+}
+
+static void
+pch_put_tokens(FILE *f, Token *t)
+{
+    Token *tt;
+    unsigned long n = 0;
+
+    for (tt = t; tt; tt = tt->next)
+        n++;
+    yasm_fwrite_32_l(n, f);
+    for (; t; t = t->next)
+    {
+        yasm_fwrite_32_l((unsigned long)t->type, f);
+        pch_put_str(f, t->text);
+    }
+}
+
+/*
+ * Macro lists are written oldest first, so that pushing each macro
+ * back on to its list when loading restores the original order.
+ */
+static void
+pch_put_smacros(FILE *f, SMacro *m)
+{
+    if (!m)
+        return;
+    pch_put_smacros(f, m->next);
+    pch_put_str(f, m->name);
+    yasm_fwrite_32_l((unsigned long)m->level, f);
+    yasm_fwrite_32_l((unsigned long)m->casesense, f);
+    yasm_fwrite_32_l((unsigned long)m->nparam, f);
+    pch_put_tokens(f, m->expansion);
+}
+
+static void
+pch_put_mmacros(FILE *f, MMacro *m)
+{
+    Line *l;
+    unsigned long n = 0;
+
+    if (!m)
+        return;
+    pch_put_mmacros(f, m->next);
+    pch_put_str(f, m->name);
+    yasm_fwrite_32_l((unsigned long)m->casesense, f);
+    yasm_fwrite_32_l((unsigned long)m->nparam_min, f);
+    yasm_fwrite_32_l((unsigned long)m->nparam_max, f);
+    yasm_fwrite_32_l((unsigned long)m->plus, f);
+    yasm_fwrite_32_l((unsigned long)m->nolist, f);
+    pch_put_tokens(f, m->dlist);
+    for (l = m->expansion; l; l = l->next)
+        n++;
+    yasm_fwrite_32_l(n, f);
+    for (l = m->expansion; l; l = l->next)
+        pch_put_tokens(f, l->first);
+}
+
+static void
+pch_put_contexts(FILE *f, Context *ctx)
+{
+    SMacro *m;
+    unsigned long n = 0;
+
+    if (!ctx)
+        return;
+    pch_put_contexts(f, ctx->next);
+    pch_put_str(f, ctx->name);
+    yasm_fwrite_32_l(ctx->number, f);
+    for (m = ctx->localmac; m; m = m->next)
+        n++;
+    yasm_fwrite_32_l(n, f);
+    pch_put_smacros(f, ctx->localmac);
+}
+
+/*
+ * Write the current macro state to a precompiled macro file. This is
+ * called once the main file has been read to the end.
+ */
+void
+pp_write_pch(FILE *f)
+{
+    unsigned long n;
+    unsigned int h;
+    IncFile *file;
+    IncName *name;
+    SMacro *sm;
+    MMacro *mm;
+    Context *ctx;
+
+    if (!main_fname || !strcmp(main_fname, "-"))
+    {
+        error(ERR_NONFATAL,
+              "cannot precompile macros read from standard input");
+        return;
+    }
+
+    fwrite(PCH_MAGIC, sizeof(PCH_MAGIC), 1, f);
+    yasm_fwrite_32_l(PCH_VERSION, f);
+    yasm_fwrite_32_l(config_hash, f);
+    pch_put_str(f, main_fname);
+    yasm_fwrite_32_l((unsigned long)main_len, f);
+    yasm_fwrite_32_l(main_hash, f);
+
+    n = 0;
+    for (h = 0; h < INC_NHASH; h++)
+        for (file = incfiles[h]; file; file = file->next)
+            n++;
+    yasm_fwrite_32_l(n, f);
+    for (h = 0; h < INC_NHASH; h++)
+    {
+        for (file = incfiles[h]; file; file = file->next)
+        {
+            pch_put_str(f, file->path);
+            yasm_fwrite_32_l((unsigned long)file->len, f);
+            yasm_fwrite_32_l(hash_buf(HASH_INIT, file->data, file->len), f);
+            yasm_fwrite_32_l((unsigned long)file->once, f);
+        }
+    }
+
+    yasm_fwrite_32_l(unique, f);
+    yasm_fwrite_32_l((unsigned long)Level, f);
+
+    n = 0;
+    for (h = 0; h < smacros_size; h++)
+        for (sm = smacros[h]; sm; sm = sm->next)
+            n++;
+    yasm_fwrite_32_l(n, f);
+    for (h = 0; h < smacros_size; h++)
+        pch_put_smacros(f, smacros[h]);
+
+    n = 0;
+    for (h = 0; h < mmacros_size; h++)
+        for (mm = mmacros[h]; mm; mm = mm->next)
+            n++;
+    yasm_fwrite_32_l(n, f);
+    for (h = 0; h < mmacros_size; h++)
+        pch_put_mmacros(f, mmacros[h]);
+
+    n = 0;
+    for (ctx = cstk; ctx; ctx = ctx->next)
+        n++;
+    yasm_fwrite_32_l(n, f);
+    pch_put_contexts(f, cstk);
+
+    n = 0;
+    for (h = 0; h < INC_NHASH; h++)
+        for (name = incnames[h]; name; name = name->next)
+            n++;
+    yasm_fwrite_32_l(n, f);
+    for (h = 0; h < INC_NHASH; h++)
+    {
+        for (name = incnames[h]; name; name = name->next)
+        {
+            pch_put_str(f, name->name);
+            pch_put_str(f, name->from);
+            pch_put_str(f, name->file->path);
+        }
+    }
+}
+
+static unsigned long
+pch_get_num(PchBuf *b)
+{
+    unsigned long val;
+
+    if (b->lim - b->p < 4)
+    {
+        b->bad = TRUE;
+        b->p = b->lim;
+        return 0;
+    }
+    YASM_READ_32_L(val, b->p);
+    return val & 0xFFFFFFFFUL;
+}
+
+/*
+ * Get a string, which is left in place in the buffer.
+ */
+static const char *
+pch_get_str(PchBuf *b)
+{
+    unsigned long len = pch_get_num(b);
+    const char *s;
+
+    if (len == 0)
+        return NULL;
+    if ((unsigned long)(b->lim - b->p) < len || b->p[len - 1] != '\0')
+    {
+        b->bad = TRUE;
+        b->p = b->lim;
+        return NULL;
+    }
+    s = (const char *)b->p;
+    b->p += len;
+    return s;
+}
+
+/*
+ * Get a string that may not be NULL.
+ */
+static const char *
+pch_get_name(PchBuf *b)
+{
+    const char *s = pch_get_str(b);
+
+    if (!s)
+        b->bad = TRUE;
+    return s ? s : "";
+}
+
+static Token *
+pch_get_tokens(PchBuf *b)
+{
+    unsigned long i, n = pch_get_num(b);
+    Token *head = NULL, **tail = &head;
+    int type;
+
+    for (i = 0; i < n && !b->bad; i++)
+    {
+        type = (int)pch_get_num(b);
+        *tail = new_Token(NULL, type, pch_get_str(b), 0);
+        tail = &(*tail)->next;
+    }
+    return head;
+}
+
+static void
+pch_get_smacros(PchBuf *b, Context *ctx, SMacro **smhead)
+{
+    unsigned long i, n = pch_get_num(b);
+    const char *name;
+    SMacro *smac;
+
+    for (i = 0; i < n && !b->bad; i++)
+    {
+        name = pch_get_name(b);
+        smac = new_smacro(ctx, ctx ? smhead : smacro_bucket(hash(name)),
+                          name);
+        smac->name = nasm_strdup(name);
+        smac->level = (int)pch_get_num(b);
+        smac->casesense = (int)pch_get_num(b);
+        smac->nparam = (int)pch_get_num(b);
+        smac->in_progress = FALSE;
+        smac->expansion = pch_get_tokens(b);
+    }
+}
+
+static void
+pch_get_mmacros(PchBuf *b)
+{
+    unsigned long i, j, n = pch_get_num(b), nlines;
+    MMacro *m;
+    Line **tail;
+
+    for (i = 0; i < n && !b->bad; i++)
+    {
+        m = nasm_malloc(sizeof(MMacro));
+        m->name = nasm_strdup(pch_get_name(b));
+        m->hash = hash(m->name);
+        m->casesense = (int)pch_get_num(b);
+        m->nparam_min = (long)pch_get_num(b);
+        m->nparam_max = (long)pch_get_num(b);
+        m->plus = (int)pch_get_num(b);
+        m->nolist = (int)pch_get_num(b);
+        m->in_progress = FALSE;
+        m->dlist = pch_get_tokens(b);
+        if (m->dlist)
+            count_mmac_params(m->dlist, &m->ndefs, &m->defaults);
+        else
+        {
+            m->defaults = NULL;
+            m->ndefs = 0;
+        }
+        m->expansion = NULL;
+        tail = &m->expansion;
+        nlines = pch_get_num(b);
+        for (j = 0; j < nlines && !b->bad; j++)
+        {
+            *tail = nasm_malloc(sizeof(Line));
+            (*tail)->next = NULL;
+            (*tail)->finishes = NULL;
+            (*tail)->first = pch_get_tokens(b);
+            tail = &(*tail)->next;
+        }
+        m->next_active = NULL;
+        m->rep_nest = NULL;
+        m->params = NULL;
+        m->iline = NULL;
+        m->nparam = m->rotate = 0;
+        m->paramlen = NULL;
+        m->unique = 0;
+        m->lineno = 0;
+
+        m->next = *mmacro_bucket(m->hash);
+        *mmacro_bucket(m->hash) = m;
+        if (++mmacros_count > mmacros_size)
+            grow_mmacros();
+    }
+}
+
+static void
+pch_get_contexts(PchBuf *b)
+{
+    unsigned long i, n = pch_get_num(b);
+    Context *ctx;
+
+    for (i = 0; i < n && !b->bad; i++)
+    {
+        ctx = nasm_malloc(sizeof(Context));
+        ctx->next = cstk;
+        ctx->localmac = NULL;
+        ctx->name = nasm_strdup(pch_get_name(b));
+        ctx->number = pch_get_num(b);
+        cstk = ctx;
+        pch_get_smacros(b, ctx, &ctx->localmac);
+    }
+}
+
+/*
+ * Read a whole file. Returns NULL if it cannot be opened.
+ */
+static char *
+pch_read_file(const char *path, const char *mode, size_t *len)
+{
+    FILE *fp = fopen(path, mode);
+    yasm_linereader lr;
+
+    if (!fp)
+        return NULL;
+    yasm_linereader_initialize(&lr, fp);
+    fclose(fp);
+    *len = (size_t)(lr.lim - lr.buf);
+    return lr.buf;
+}
+
+/*
+ * Check that a recorded file still has the same contents. Unless it
+ * is already in the include cache, its contents are kept in pf for
+ * adding to the cache.
+ */
+static int
+pch_check_file(PchFile *pf, unsigned long len, unsigned long h)
+{
+    IncFile *f = find_inc_file(pf->path);
+    const char *data;
+
+    pf->data = NULL;
+    if (f)
+    {
+        data = f->data;
+        pf->len = f->len;
+    }
+    else
+    {
+        data = pf->data = pch_read_file(pf->path, "r", &pf->len);
+        if (!data)
+            return FALSE;
+    }
+    return pf->len == len &&
+        hash_buf(HASH_INIT, data, pf->len) == (unsigned int)h;
+}
+
+/*
+ * Load the precompiled macro file requested by pp_pre_include_pch().
+ * If it is out of date, the header it was made from is included in
+ * its place.
+ */
+static void
+load_pch(PchLoad *pl)
+{
+    yasm_linereader lr;
+    size_t len;
+    PchBuf b;
+    PchFile header, *files = NULL;
+    const char *reason = NULL;
+    unsigned long i, nfiles = 0, flen, fhash;
+    IncFile *f;
+
+    b.p = (const unsigned char *)pch_read_file(pl->fname, "rb", &len);
+    if (!b.p)
+    {
+        error(ERR_FATAL, "unable to open precompiled macros `%s'",
+              pl->fname);
+        return;
+    }
+    lr.buf = (char *)b.p;
+    b.lim = b.p + len;
+    b.bad = FALSE;
+
+    if (len < sizeof(PCH_MAGIC) ||
+            memcmp(b.p, PCH_MAGIC, sizeof(PCH_MAGIC)) != 0)
+        error(ERR_FATAL, "`%s' is not a precompiled macro file", pl->fname);
+    b.p += sizeof(PCH_MAGIC);
+    if (pch_get_num(&b) != PCH_VERSION)
+        error(ERR_FATAL, "precompiled macros `%s' are from another version",
+              pl->fname);
+
+    /* Check the configuration and every file that went into it */
+    if (pch_get_num(&b) != pl->config)
+        reason = "options differ";
+    header.path = pch_get_name(&b);
+    header.once = FALSE;
+    flen = pch_get_num(&b);
+    fhash = pch_get_num(&b);
+    if (!pch_check_file(&header, flen, fhash) && !b.bad)
+        reason = "header changed";
+    nfiles = pch_get_num(&b);
+    if (nfiles > len)
+        b.bad = TRUE;
+    else if (nfiles)
+        files = nasm_malloc(nfiles * sizeof(PchFile));
+    for (i = 0; i < nfiles && !b.bad; i++)
+    {
+        files[i].path = pch_get_name(&b);
+        flen = pch_get_num(&b);
+        fhash = pch_get_num(&b);
+        files[i].once = (int)pch_get_num(&b);
+        if (!pch_check_file(&files[i], flen, fhash) && !reason)
+            reason = "included file changed";
+    }
+    if (b.bad)
+        error(ERR_FATAL, "precompiled macros `%s' are corrupt", pl->fname);
+
+    if (reason)
+    {
+        Token *inc, *space, *name;
+        Line *l;
+
+        error(ERR_WARNING, "precompiled macros `%s' are out of date (%s),"
+              " including `%s' instead", pl->fname, reason, header.path);
+
+        /* The header was found by its recorded path, which the include
+         * search may not find from here, so point the %include at it. */
+        if (header.data)
+            f = new_inc_file(header.path, header.data, header.len);
+        else
+            f = find_inc_file(header.path);
+        if (f)
+            add_inc_name(header.path,
+                         nasm_src_get_fname() ? nasm_src_get_fname() : "", f);
+        name = new_Token(NULL, TOK_INTERNAL_STRING, header.path, 0);
+        space = new_Token(name, TOK_WHITESPACE, NULL, 0);
+        inc = new_Token(space, TOK_PREPROC_ID, "%include", 0);
+        l = nasm_malloc(sizeof(Line));
+        l->next = istk->expansion;
+        l->first = inc;
+        l->finishes = NULL;
+        istk->expansion = l;
+
+        nfiles = i;
+        for (i = 0; i < nfiles; i++)
+            if (files[i].data)
+                yasm_xfree(files[i].data);
+        nasm_free(files);
+        yasm_xfree(lr.buf);
+        return;
+    }
+
+    /* Up to date: replace the macro state with the saved one */
+    free_macros();
+    i = pch_get_num(&b);
+    if (i > unique)
+        unique = i;
+    Level = (int)pch_get_num(&b);
+    pch_get_smacros(&b, NULL, NULL);
+    pch_get_mmacros(&b);
+    pch_get_contexts(&b);
+
+    /* Carry over the include cache */
+    nasm_preproc_add_dep(pl->fname);
+    if (header.data)
+        new_inc_file(header.path, header.data, header.len);
+    nasm_preproc_add_dep(find_inc_file(header.path)->path);
+    for (i = 0; i < nfiles; i++)
+    {
+        if (files[i].data)
+            f = new_inc_file(files[i].path, files[i].data, files[i].len);
+        else
+            f = find_inc_file(files[i].path);
+        if (files[i].once)
+            f->once = TRUE;
+        nasm_preproc_add_dep(f->path);
+    }
+    nasm_free(files);
+    nfiles = pch_get_num(&b);
+    for (i = 0; i < nfiles && !b.bad; i++)
+    {
+        const char *name = pch_get_name(&b);
+        const char *from = pch_get_name(&b);
+
+        f = find_inc_file(pch_get_name(&b));
+        if (f)
+            add_inc_name(name, from, f);
+    }
+    if (b.bad || b.p != b.lim)
+        error(ERR_FATAL, "precompiled macros `%s' are corrupt", pl->fname);
+    yasm_xfree(lr.buf);
+}
+
 static void
 make_tok_num(Token * tok, yasm_intnum *val)
 {
     tok->text = yasm_intnum_get_str(val);
     tok->type = TOK_NUMBER;
+    rehash_Token(tok);
     yasm_intnum_destroy(val);
 }
 
@@ -10,10 +10,12 @@
 #define YASM_NASM_PREPROC_H
 
 void pp_pre_include (const char *);
+void pp_pre_include_pch (const char *);
 void pp_pre_define (char *);
 void pp_pre_undefine (char *);
 void pp_builtin_define (char *);
 void pp_extra_stdmac (const char **);
+void pp_write_pch (FILE *);
 
 extern Preproc nasmpp;
 
@@ -46,6 +46,7 @@ yasm_symtab *nasm_symtab;
 static yasm_linemap *cur_lm;
 static yasm_errwarns *cur_errwarns;
 int tasm_compatible_mode = 0;
+int nasm_preproc_only = 0;
 int tasm_locals;
 const char *tasm_segment;
 
@@ -149,6 +150,8 @@ nasm_preproc_create(const char *in_filename, yasm_symtab *symtab,
 
     preproc_nasm->in = f;
     nasm_symtab = symtab;
+    /* The frontend passes no symbol table when it only preprocesses */
+    nasm_preproc_only = (symtab == NULL);
     cur_lm = lm;
     cur_errwarns = errwarns;
     preproc_deps = NULL;
@@ -182,13 +185,15 @@ nasm_preproc_destroy(yasm_preproc *preproc)
 }
 
 static char *
-nasm_preproc_get_line(yasm_preproc *preproc)
+nasm_preproc_get_line_ex(yasm_preproc *preproc, yasm_preproc_lineinfo *info)
 {
     yasm_preproc_nasm *preproc_nasm = (yasm_preproc_nasm *)preproc;
     long linnum;
     int altline;
     char *line;
 
+    info->changed = 0;
+
     if (preproc_nasm->line) {
         char *retval = preproc_nasm->line;
         preproc_nasm->line = NULL;
@@ -207,11 +212,30 @@ nasm_preproc_get_line(yasm_preproc *preproc)
     if (altline != 0) {
         preproc_nasm->lineinc =
             (altline != -1 || preproc_nasm->lineinc != 1);
-        preproc_nasm->line = line;
-        line = yasm_xmalloc(40+strlen(preproc_nasm->file_name));
-        sprintf(line, "%%line %ld+%d %s", linnum,
-                preproc_nasm->lineinc, preproc_nasm->file_name);
         preproc_nasm->prior_linnum = linnum;
+        info->changed = 1;
+        info->filename = preproc_nasm->file_name;
+        info->line = (unsigned long)linnum;
+        info->line_inc = (unsigned long)preproc_nasm->lineinc;
+    }
+
+    return line;
+}
+
+static char *
+nasm_preproc_get_line(yasm_preproc *preproc)
+{
+    yasm_preproc_nasm *preproc_nasm = (yasm_preproc_nasm *)preproc;
+    yasm_preproc_lineinfo info;
+    char *line;
+
+    line = nasm_preproc_get_line_ex(preproc, &info);
+    if (line && info.changed) {
+        /* Hold the line back and return a %line directive ahead of it */
+        preproc_nasm->line = line;
+        line = yasm_xmalloc(40+strlen(info.filename));
+        sprintf(line, "%%line %lu+%lu %s", info.line, info.line_inc,
+                info.filename);
     }
 
     return line;
@@ -277,6 +301,18 @@ nasm_preproc_add_include_file(yasm_preproc *preproc, const char *filename)
     pp_pre_include(filename);
 }
 
+static void
+nasm_preproc_add_include_pch(yasm_preproc *preproc, const char *filename)
+{
+    pp_pre_include_pch(filename);
+}
+
+static void
+nasm_preproc_write_pch(yasm_preproc *preproc, FILE *f)
+{
+    pp_write_pch(f);
+}
+
 static void
 nasm_preproc_predefine_macro(yasm_preproc *preproc, const char *macronameval)
 {
@@ -319,7 +355,10 @@ yasm_preproc_module yasm_nasm_LTX_preproc = {
     nasm_preproc_predefine_macro,
     nasm_preproc_undefine_macro,
     nasm_preproc_define_builtin,
-    nasm_preproc_add_standard
+    nasm_preproc_add_standard,
+    nasm_preproc_get_line_ex,
+    nasm_preproc_add_include_pch,
+    nasm_preproc_write_pch
 };
 
 static yasm_preproc *
@@ -341,5 +380,8 @@ yasm_preproc_module yasm_tasm_LTX_preproc = {
     nasm_preproc_predefine_macro,
     nasm_preproc_undefine_macro,
     nasm_preproc_define_builtin,
-    nasm_preproc_add_standard
+    nasm_preproc_add_standard,
+    nasm_preproc_get_line_ex,
+    nasm_preproc_add_include_pch,
+    nasm_preproc_write_pch
 };
@@ -276,6 +276,7 @@ enum {
 #define elements(x)     ( sizeof(x) / sizeof(*(x)) )
 
 extern int tasm_compatible_mode;
+extern int nasm_preproc_only;
 extern int tasm_locals;
 extern const char *tasm_segment;
 const char *tasm_get_segment_register(const char *segment);
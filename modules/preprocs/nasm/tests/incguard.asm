@@ -0,0 +1,11 @@
+; Repeat includes of guarded and %pragma once files are skipped;
+; other files are read again each time.
+%include "incguard.inc"
+%include "incguard.inc"
+%include "inconce.inc"
+%include "inconce.inc"
+%include "incplain.inc"
+%include "incplain.inc"
+%undef INCGUARD_INC
+%include "incguard.inc"
+db guarded, once, plain
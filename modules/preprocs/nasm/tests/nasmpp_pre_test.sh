@@ -0,0 +1,77 @@
+#! /bin/sh
+
+YASM_TEST_SUITE=1
+export YASM_TEST_SUITE
+
+case `echo "testing\c"; echo 1,2,3`,`echo -n testing; echo 1,2,3` in
+  *c*,-n*) ECHO_N= ECHO_C='
+' ECHO_T='	' ;;
+  *c*,*  ) ECHO_N=-n ECHO_C= ECHO_T= ;;
+  *)       ECHO_N= ECHO_C='\c' ECHO_T= ;;
+esac
+
+mkdir results >/dev/null 2>&1
+
+#
+# Verify preprocessed output (.pre) and list files (.lst), for the tests
+# that have them.
+#
+
+passedct=0
+failedct=0
+
+echo $ECHO_N "Test nasmpp_pre_test: $ECHO_C"
+for asm in ${srcdir}/modules/preprocs/nasm/tests/*.asm
+do
+    a=`echo ${asm} | sed 's,^.*/,,;s,.asm$,,'`
+    pg=`echo ${asm} | sed 's,.asm$,.pre,'`
+    lg=`echo ${asm} | sed 's,.asm$,.lst,'`
+
+    if test -f ${pg}; then
+        # Run within a subshell to prevent signal messages from displaying.
+        sh -c "cat ${asm} | ./yasm -e - > results/${a}.pp 2>/dev/null" >/dev/null 2>/dev/null
+        status=$?
+        if test $status -gt 128; then
+            echo $ECHO_N "C$ECHO_C"
+            eval "failed$failedct='C: ${a} crashed!'"
+            failedct=`expr $failedct + 1`
+        elif diff -w ${pg} results/${a}.pp >/dev/null; then
+            echo $ECHO_N ".$ECHO_C"
+            passedct=`expr $passedct + 1`
+        else
+            echo $ECHO_N "P$ECHO_C"
+            eval "failed$failedct='P: ${a} did not match preprocessed output!'"
+            failedct=`expr $failedct + 1`
+        fi
+    fi
+
+    if test -f ${lg}; then
+        sh -c "cat ${asm} | ./yasm -f bin -l results/${a}.ls -o results/${a}.lo - 2>/dev/null" >/dev/null 2>/dev/null
+        status=$?
+        if test $status -gt 128; then
+            echo $ECHO_N "C$ECHO_C"
+            eval "failed$failedct='C: ${a} crashed!'"
+            failedct=`expr $failedct + 1`
+        elif diff -w ${lg} results/${a}.ls >/dev/null; then
+            echo $ECHO_N ".$ECHO_C"
+            passedct=`expr $passedct + 1`
+        else
+            echo $ECHO_N "L$ECHO_C"
+            eval "failed$failedct='L: ${a} did not match list file!'"
+            failedct=`expr $failedct + 1`
+        fi
+    fi
+done
+
+ct=`expr $failedct + $passedct`
+per=`expr 100 \* $passedct / $ct`
+
+echo " +$passedct-$failedct/$ct $per%"
+i=0
+while test $i -lt $failedct; do
+    eval "failure=\$failed$i"
+    echo " ** $failure"
+    i=`expr $i + 1`
+done
+
+exit $failedct
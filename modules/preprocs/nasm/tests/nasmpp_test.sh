@@ -1,3 +1,3 @@
 #! /bin/sh
-${srcdir}/out_test.sh nasmpp_test modules/preprocs/nasm/tests "nasm preproc" "-f bin" ""
+${srcdir}/out_test.sh nasmpp_test modules/preprocs/nasm/tests "nasm preproc" "-f bin -I${srcdir}/modules/preprocs/nasm/tests/" ""
 exit $?
@@ -0,0 +1,107 @@
+#! /bin/sh
+
+YASM_TEST_SUITE=1
+export YASM_TEST_SUITE
+
+case `echo "testing\c"; echo 1,2,3`,`echo -n testing; echo 1,2,3` in
+  *c*,-n*) ECHO_N= ECHO_C='
+' ECHO_T='	' ;;
+  *c*,*  ) ECHO_N=-n ECHO_C= ECHO_T= ;;
+  *)       ECHO_N= ECHO_C='\c' ECHO_T= ;;
+esac
+
+mkdir results >/dev/null 2>&1
+
+#
+# Precompile a header with --make-pch, then check that --include-pch
+# preprocesses the same as pre-including the header with -P.
+#
+
+passedct=0
+failedct=0
+
+T=${srcdir}/modules/preprocs/nasm/tests/pch
+asm=${T}/pchuse.asm
+h=results/pchdefs.inc
+opts="-Iresults/"
+
+pass() {
+    echo $ECHO_N ".$ECHO_C"
+    passedct=`expr $passedct + 1`
+}
+
+fail() {
+    echo $ECHO_N "$1$ECHO_C"
+    eval "failed$failedct='$1: $2'"
+    failedct=`expr $failedct + 1`
+}
+
+# Compare --include-pch of $1 against -P of the header; $2 names the test.
+check_pch() {
+    eg=${T}/$2.errwarn
+    if test \! -f ${eg}; then
+        eg=/dev/null
+    fi
+    sh -c "cat ${asm} | ./yasm ${opts} -e --include-pch=$1 - > results/$2.pp 2>results/$2.ew" >/dev/null 2>/dev/null
+    status=$?
+    cat ${asm} | ./yasm ${opts} -e -P ${h} - > results/$2.ppg 2>/dev/null
+    if test $status -gt 128; then
+        fail C "$2 crashed!"
+    elif test $status -gt 0; then
+        fail E "$2 returned an error code!"
+    elif diff -w results/$2.ppg results/$2.pp >/dev/null; then
+        if diff -w ${eg} results/$2.ew >/dev/null; then
+            pass
+        else
+            fail W "$2 did not match errors and warnings!"
+        fi
+    else
+        fail O "$2 did not match preprocessed output!"
+    fi
+}
+
+echo $ECHO_N "Test nasmpch_test: $ECHO_C"
+
+cp ${T}/pchdefs.inc ${T}/pchmore.inc results/
+rm -f results/pch.pch
+sh -c "./yasm ${opts} --make-pch -o results/pch.pch ${h} 2>results/pch-make.ew" >/dev/null 2>/dev/null
+if test $? -gt 0; then
+    fail E "pch-make returned an error code!"
+elif diff -w /dev/null results/pch-make.ew >/dev/null; then
+    pass
+else
+    fail W "pch-make did not match errors and warnings!"
+fi
+
+check_pch results/pch.pch pch
+
+# Truncated precompiled macros must be rejected without a crash.
+dd if=results/pch.pch of=results/pch-corrupt.pch bs=200 count=1 >/dev/null 2>&1
+sh -c "cat ${asm} | ./yasm ${opts} -e --include-pch=results/pch-corrupt.pch - > /dev/null 2>results/pch-corrupt-err.ew" >/dev/null 2>/dev/null
+status=$?
+if test $status -gt 128; then
+    fail C "pch-corrupt-err crashed!"
+elif test $status -eq 0; then
+    fail E "pch-corrupt-err did not return an error code!"
+elif diff -w ${T}/pch-corrupt-err.errwarn results/pch-corrupt-err.ew >/dev/null; then
+    pass
+else
+    fail W "pch-corrupt-err did not match errors and warnings!"
+fi
+
+# Once the header changes, the header is included instead, with a warning.
+echo "%define VALUE 6" >> ${h}
+check_pch results/pch.pch pch-stale
+
+ct=`expr $failedct + $passedct`
+per=`expr 100 \* $passedct / $ct`
+
+echo " +$passedct-$failedct/$ct $per%"
+i=0
+while test $i -lt $failedct; do
+    eval "failure=\$failed$i"
+    echo " ** $failure"
+    i=`expr $i + 1`
+done
+
+exit $failedct
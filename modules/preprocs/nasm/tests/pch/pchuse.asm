@@ -0,0 +1,10 @@
+emit VALUE
+emit VALUE, 9
+TWICE 4
+dw TWICE(VALUE)
+db %$local
+%pop
+%include "pchmore.inc"
+%ifdef PCHMORE_INC
+db COUNT
+%endif
@@ -0,0 +1,24 @@
+; Constant %rep bodies are folded into TIMES; anything that varies per
+; iteration must still be replayed line by line.
+start:
+%rep 3
+db 1, "ab", start
+%endrep
+%rep 2
+dw $
+%endrep
+%define X 7
+%rep 2
+db X
+%endrep
+%rep 2
+%rep 3
+db 5
+%endrep
+db 6
+%endrep
+%assign i 0
+%rep 3
+db i
+%assign i i+1
+%endrep
@@ -0,0 +1,15 @@
+; Lines are only expanded when an identifier may name a macro; make sure
+; case-insensitive, context-local, undefined and pasted names still work.
+%idefine Foo 1
+db FOO, foo
+%push ctx
+%define %$bar 2
+db %$bar
+%pop
+%define baz 3
+%undef baz
+baz equ 4
+db baz
+%define pre lab
+db pre %+ el
+label equ 7
@@ -165,5 +165,8 @@ yasm_preproc_module yasm_raw_LTX_preproc = {
     raw_preproc_predefine_macro,
     raw_preproc_undefine_macro,
     raw_preproc_define_builtin,
-    raw_preproc_add_standard
+    raw_preproc_add_standard,
+    NULL,
+    NULL,
+    NULL
 };
@@ -28,9 +28,130 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #define MAXLINE 1024
 
+/* The NASM preprocessor (the only user of the generated tables) is spared
+ * tokenizing the macros at every startup: each line is written already
+ * split into tokens.  A split line starts with SPLIT_MARK; each token is
+ * its type as a single byte followed by its text.  Token types and the
+ * character classes below must match modules/preprocs/nasm/nasm-pp.c and
+ * nasm.h.  Lines that cannot be represented this way are written as-is.
+ */
+#define SPLIT_MARK      0177
+
+#define TOK_WHITESPACE  1
+#define TOK_ID          3
+#define TOK_PREPROC_ID  4
+#define TOK_STRING      5
+#define TOK_NUMBER      6
+#define TOK_OTHER       8
+
+#define isidstart(c) ( isalpha(c) || (c)=='_' || (c)=='.' || (c)=='?' \
+                                  || (c)=='@' )
+#define isidchar(c)  ( isidstart(c) || isdigit(c) || (c)=='$' || (c)=='#' \
+                                                  || (c)=='~' )
+#define isnumstart(c)  ( isdigit(c) || (c)=='$' )
+#define isnumchar(c)   ( isalnum(c) )
+
+/* Split a line into tokens the same way the NASM preprocessor does,
+ * writing it into buf.  Returns 0 if the line cannot be split.
+ */
+static int
+split_line(const char *line, char *buf)
+{
+    const char *p, *text, *end;
+    int type;
+
+    *buf++ = (char)SPLIT_MARK;
+    while (*line) {
+        p = line;
+        text = line;
+        if (*p == '%') {
+            p++;
+            if (isdigit((unsigned char)*p) ||
+                ((*p == '-' || *p == '+') && isdigit((unsigned char)p[1])) ||
+                (*p == '+' && (isspace((unsigned char)p[1]) || !p[1]))) {
+                do {
+                    p++;
+                } while (isdigit((unsigned char)*p));
+            } else if (*p == '{') {
+                /* %{name} is the token %name */
+                end = strchr(p, '}');
+                if (!end || end == p+1)
+                    return 0;
+                *buf++ = TOK_PREPROC_ID;
+                *buf++ = '%';
+                memcpy(buf, p+1, (size_t)(end-p-1));
+                buf += end-p-1;
+                line = end+1;
+                continue;
+            } else if (isidchar((unsigned char)*p) ||
+                       ((*p == '!' || *p == '%' || *p == '$') &&
+                        isidchar((unsigned char)p[1]))) {
+                do {
+                    p++;
+                } while (isidchar((unsigned char)*p));
+            } else {
+                type = TOK_OTHER;
+                if (*p == '%')
+                    p++;
+                goto have_token;
+            }
+            type = TOK_PREPROC_ID;
+        } else if (isidstart((unsigned char)*p) ||
+                   (*p == '$' && isidstart((unsigned char)p[1]))) {
+            type = TOK_ID;
+            p++;
+            while (*p && isidchar((unsigned char)*p))
+                p++;
+        } else if (*p == '\'' || *p == '"') {
+            type = TOK_STRING;
+            end = strchr(p+1, *p);
+            if (!end)
+                return 0;
+            p = end+1;
+        } else if (isnumstart((unsigned char)*p)) {
+            type = TOK_NUMBER;
+            p++;
+            while (*p && isnumchar((unsigned char)*p))
+                p++;
+        } else if (isspace((unsigned char)*p)) {
+            type = TOK_WHITESPACE;
+            while (isspace((unsigned char)*p))
+                p++;
+            text = p;       /* whitespace has no text */
+        } else {
+            type = TOK_OTHER;
+            if ((p[0] == '>' && p[1] == '>') ||
+                (p[0] == '<' && p[1] == '<') ||
+                (p[0] == '/' && p[1] == '/') ||
+                (p[0] == '<' && p[1] == '=') ||
+                (p[0] == '>' && p[1] == '=') ||
+                (p[0] == '=' && p[1] == '=') ||
+                (p[0] == '!' && p[1] == '=') ||
+                (p[0] == '<' && p[1] == '>') ||
+                (p[0] == '&' && p[1] == '&') ||
+                (p[0] == '|' && p[1] == '|') ||
+                (p[0] == '^' && p[1] == '^'))
+                p++;
+            p++;
+        }
+have_token:
+        *buf++ = (char)type;
+        for (; text < p; text++) {
+            /* token text must not look like a token type */
+            if ((unsigned char)*text < ' ')
+                return 0;
+            *buf++ = *text;
+        }
+        line = p;
+    }
+    *buf = '\0';
+    return 1;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -39,6 +160,7 @@ main(int argc, char *argv[])
     char *str;
     char *strp;
     char *charp;
+    char *split;
     int fline;
     int line = 0;
     int lindex = 0;
@@ -57,6 +179,7 @@ main(int argc, char *argv[])
     }
 
     str = malloc(MAXLINE);
+    split = malloc(2*MAXLINE);
 
     fprintf(out, "/* This file auto-generated from standard.mac by genmacro.c"
                  " - don't edit it */\n\n#include <stddef.h>\n\n"
@@ -110,12 +233,20 @@ main(int argc, char *argv[])
             if (len == 0)
                 continue;
 
-            /* output as string to output file */
+            /* output as string to output file, split into tokens if
+             * possible */
             fprintf(out, "    \"");
+            if (split_line(strp, split))
+                strp = split;
             while (*strp != '\0') {
-                if (*strp == '\\' || *strp == '"')
-                    fputc('\\', out);
-                fputc(*strp, out);
+                if ((unsigned char)*strp < ' ' ||
+                    (unsigned char)*strp == SPLIT_MARK)
+                    fprintf(out, "\\%03o", (unsigned char)*strp);
+                else {
+                    if (*strp == '\\' || *strp == '"')
+                        fputc('\\', out);
+                    fputc(*strp, out);
+                }
                 strp++;
             }
             fprintf(out, "\",\n");
@@ -129,6 +260,7 @@ main(int argc, char *argv[])
     fclose(out);
 
     free(str);
+    free(split);
 
     return EXIT_SUCCESS;
 }